@@ -0,0 +1,219 @@
+#pragma once
+#ifndef ANIMATION_HPP
+#define ANIMATION_HPP
+
+#include "common.hpp"
+#include "utils/hittable.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * @brief A camera path and per-object translations over a sequence of frames.
+ *
+ * Both are keyframed: between keys a value is interpolated linearly, before
+ * the first and after the last key it holds. Objects are named by their index
+ * in the scene's object list and move relative to where the scene put them.
+ */
+struct animation
+{
+    struct camera_key
+    {
+        int frame;
+        point3 lookfrom;
+        point3 lookat;
+    };
+
+    struct move_key
+    {
+        int frame;
+        vec3 offset;
+    };
+
+    struct track
+    {
+        size_t object;
+        std::vector<move_key> keys; // by frame
+    };
+
+    int frames = 0;
+    std::vector<camera_key> camera_keys; // by frame
+    std::vector<track> tracks;
+
+    void camera_at(int frame, point3 &lookfrom, point3 &lookat) const
+    {
+        auto blend = between(camera_keys, frame);
+        const auto &a = camera_keys[blend.first], &b = camera_keys[blend.first + 1 < camera_keys.size() ? blend.first + 1 : blend.first];
+        lookfrom = (1 - blend.second) * a.lookfrom + blend.second * b.lookfrom;
+        lookat = (1 - blend.second) * a.lookat + blend.second * b.lookat;
+    }
+
+    static vec3 offset_at(const track &t, int frame)
+    {
+        auto blend = between(t.keys, frame);
+        const auto &a = t.keys[blend.first], &b = t.keys[blend.first + 1 < t.keys.size() ? blend.first + 1 : blend.first];
+        return (1 - blend.second) * a.offset + blend.second * b.offset;
+    }
+
+private:
+    // @brief Index of the key at or before frame (or the first) and the weight of the one after it.
+    template <typename Key>
+    static std::pair<size_t, real> between(const std::vector<Key> &keys, int frame)
+    {
+        auto after = std::upper_bound(keys.begin(), keys.end(), frame,
+                                      [](int f, const Key &key)
+                                      { return f < key.frame; });
+        if (after == keys.begin())
+        {
+            return {0, 0};
+        }
+        auto index = static_cast<size_t>(after - keys.begin()) - 1;
+        if (after == keys.end())
+        {
+            return {index, 0};
+        }
+        return {index, static_cast<real>(frame - keys[index].frame) / (after->frame - keys[index].frame)};
+    }
+};
+
+/**
+ * @brief Read an animation from a text file, one statement per line, # comments:
+ *   frames N
+ *   camera FRAME FROM_X FROM_Y FROM_Z AT_X AT_Y AT_Z
+ *   move OBJECT FRAME DX DY DZ
+ * Keys may come in any order.
+ * @return false if the file is missing or malformed, or has no camera key
+ */
+inline bool load_animation(const std::string &path, animation &out)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        return false;
+    }
+    animation result;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream in(line.substr(0, line.find('#')));
+        std::string keyword;
+        if (!(in >> keyword))
+        {
+            continue;
+        }
+        double v[6];
+        if (keyword == "frames")
+        {
+            if (!(in >> result.frames) || result.frames <= 0)
+            {
+                return false;
+            }
+        }
+        else if (keyword == "camera")
+        {
+            int frame;
+            if (!(in >> frame >> v[0] >> v[1] >> v[2] >> v[3] >> v[4] >> v[5]))
+            {
+                return false;
+            }
+            result.camera_keys.push_back({frame, point3(v[0], v[1], v[2]), point3(v[3], v[4], v[5])});
+        }
+        else if (keyword == "move")
+        {
+            size_t object;
+            int frame;
+            if (!(in >> object >> frame >> v[0] >> v[1] >> v[2]))
+            {
+                return false;
+            }
+            auto found = std::find_if(result.tracks.begin(), result.tracks.end(),
+                                      [&](const animation::track &t)
+                                      { return t.object == object; });
+            if (found == result.tracks.end())
+            {
+                result.tracks.push_back({object, {}});
+                found = result.tracks.end() - 1;
+            }
+            found->keys.push_back({frame, vec3(v[0], v[1], v[2])});
+        }
+        else
+        {
+            return false;
+        }
+    }
+    if (result.frames <= 0 || result.camera_keys.empty())
+    {
+        return false;
+    }
+
+    auto by_frame = [](const auto &a, const auto &b)
+    { return a.frame < b.frame; };
+    std::stable_sort(result.camera_keys.begin(), result.camera_keys.end(), by_frame);
+    for (auto &t : result.tracks)
+    {
+        std::stable_sort(t.keys.begin(), t.keys.end(), by_frame);
+    }
+    out = std::move(result);
+    return true;
+}
+
+// @brief path with the frame number inserted before its extension, image.ppm to image-0007.ppm.
+inline std::string frame_path(const std::string &path, int frame)
+{
+    char number[16];
+    std::snprintf(number, sizeof(number), "-%04d", frame);
+    auto dot = path.rfind('.');
+    auto slash = path.rfind('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    {
+        return path + number;
+    }
+    return path.substr(0, dot) + number + path.substr(dot);
+}
+
+/**
+ * @brief Built-in animation: one camera orbit around the origin, and every
+ * object but the first (the ground) bouncing twice, in a phase set by where
+ * it stands. Keys on every frame, so the orbit is a true circle.
+ */
+inline animation orbit_animation(int frames, const hittable_list &objects, const point3 &lookfrom,
+                                 const point3 &lookat)
+{
+    animation result;
+    result.frames = frames;
+    const auto offset = lookfrom - lookat;
+    const auto radius = sqrt(offset.x() * offset.x() + offset.z() * offset.z());
+    const auto start = atan2(offset.x(), offset.z());
+    for (int f = 0; f < frames; f++)
+    {
+        auto angle = start + 2 * pi * f / frames;
+        result.camera_keys.push_back(
+            {f, lookat + vec3(radius * sin(angle), offset.y(), radius * cos(angle)), lookat});
+    }
+
+    const auto &list = objects.get_objects();
+    aabb box;
+    for (size_t k = 1; k < list.size(); k++)
+    {
+        if (!list[k]->bounding_box(box))
+        {
+            continue;
+        }
+        auto center = box.centroid();
+        auto phase = center.x() * 0.7 + center.z() * 1.3;
+        animation::track t{k, {}};
+        for (int f = 0; f < frames; f++)
+        {
+            t.keys.push_back({f, vec3(0, 0.3 * fabs(sin(4 * pi * f / frames + phase)), 0)});
+        }
+        result.tracks.push_back(std::move(t));
+    }
+    return result;
+}
+
+#endif
@@ -0,0 +1,319 @@
+/**
+ * @file bench.cpp
+ * @brief Microbenchmarks of the intersection, sampling and shading kernels.
+ *
+ * Usage: ray-tracing-bench [filter]
+ * Each benchmark is calibrated to run for at least min_time per repetition and
+ * the fastest of several repetitions is reported. Inputs come from fixed seeds,
+ * so runs are repeatable. The rays/s column is calls per second, which for the
+ * sampling and shading kernels means samples or scatter events per second.
+ * A table of the sizes of the core types comes first; `make bench-precision`
+ * joins the tables of the double and the float (RT_USE_FLOAT) builds.
+ */
+
+#include "common.hpp"
+#include "camera.hpp"
+#include "utils/bvh.hpp"
+#include "utils/sphere.hpp"
+#include "utils/sphere_set.hpp"
+#include "utils/material.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// @brief Keep the optimizer from discarding a computed value.
+template <typename T>
+inline void do_not_optimize(const T &value)
+{
+    asm volatile(""
+                 :
+                 : "r,m"(value)
+                 : "memory");
+}
+
+class bench_runner
+{
+public:
+    explicit bench_runner(std::string filter) : filter(std::move(filter))
+    {
+        std::printf("%-40s %12s %14s\n", "benchmark", "ns/op", "rays/s");
+    }
+
+    /**
+     * @brief Time body(i) over increasing iteration counts, report the best ns per call,
+     * or per ray when each call traces rays_per_call rays.
+     */
+    template <typename F>
+    void run(const std::string &name, F &&body, int rays_per_call = 1)
+    {
+        if (!filter.empty() && name.find(filter) == std::string::npos)
+        {
+            return;
+        }
+
+        size_t iterations = 1024;
+        while (time_of(body, iterations) < min_time)
+        {
+            iterations *= 2;
+        }
+
+        auto best = std::numeric_limits<double>::infinity();
+        for (int r = 0; r < repetitions; r++)
+        {
+            best = std::min(best, time_of(body, iterations));
+        }
+        auto ns = best * 1e9 / iterations / rays_per_call;
+        std::printf("%-40s %12.2f %14.4g\n", name.c_str(), ns, 1e9 / ns);
+    }
+
+private:
+    static constexpr double min_time = 0.1;
+    static constexpr int repetitions = 5;
+
+    std::string filter;
+
+    template <typename F>
+    static double time_of(F &body, size_t iterations)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; i++)
+        {
+            body(i);
+        }
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+// @brief Footprint of the types the hot loops stream through, which depends on real.
+void print_sizes()
+{
+    const std::pair<const char *, size_t> sizes[] = {
+        {"vec3", sizeof(vec3)},
+        {"ray", sizeof(ray)},
+        {"hit_record", sizeof(hit_record)},
+        {"sphere", sizeof(sphere)},
+        {"bvh_flat_node", sizeof(bvh_flat_node)},
+        {"sphere_set, per sphere", sphere_set::sphere_bytes},
+        {"material", sizeof(material)},
+    };
+    std::printf("%-40s %12s\n", "sizeof", "bytes");
+    for (const auto &size : sizes)
+    {
+        std::printf("%-40s %12zu\n", size.first, size.second);
+    }
+    std::printf("\n");
+}
+
+// Inputs are cycled through a power of two sized pool.
+constexpr size_t pool_size = 4096;
+
+// @brief Rays from a box around the origin towards points near it.
+std::vector<ray> make_rays(double spread)
+{
+    std::vector<ray> rays;
+    for (size_t i = 0; i < pool_size; i++)
+    {
+        auto origin = point3(0, 1, 10) + vec3::random(-0.5, 0.5);
+        auto target = vec3::random(-spread, spread);
+        rays.emplace_back(origin, target - origin);
+    }
+    return rays;
+}
+
+// @brief Spheres scattered like random_scene(), on a grid of about n cells.
+hittable_list make_spheres(size_t n, const material *m)
+{
+    hittable_list list;
+    auto side = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(n))));
+    for (size_t k = 0; k < n; k++)
+    {
+        auto a = static_cast<int>(k) % side - side / 2;
+        auto b = static_cast<int>(k) / side - side / 2;
+        point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
+        list.add(make_shared<sphere>(center, 0.2, m));
+    }
+    return list;
+}
+
+// @brief The spheres of list as a sphere_set.
+shared_ptr<sphere_set> make_sphere_set(const hittable_list &list)
+{
+    sphere_set_builder builder;
+    for (const auto &object : list.get_objects())
+    {
+        auto *s = static_cast<const sphere *>(object.get());
+        builder.add(s->get_center(), s->get_radius(), builder.material_index(s->get_material()));
+    }
+    return builder.build();
+}
+
+int main(int argc, char *argv[])
+{
+    print_sizes();
+    bench_runner bench(argc > 1 ? argv[1] : "");
+    thread_samples().generator() = pcg32(42, 54);
+
+    material_list materials;
+    auto diffuse = materials.add(lambertian(color(0.5, 0.5, 0.5)));
+
+    // Intersection
+    {
+        sphere target(point3(0, 0, 0), 1.0, diffuse);
+        auto toward = make_rays(0.5);
+        auto away = make_rays(0.5);
+        for (auto &r : away)
+        {
+            r = ray(r.origin(), -r.direction());
+        }
+
+        bench.run("sphere::hit/hit", [&](size_t i)
+                  {
+                      hit_record rec;
+                      do_not_optimize(target.hit(toward[i & (pool_size - 1)], 0, infinity, rec));
+                      do_not_optimize(rec); });
+        bench.run("sphere::hit/miss", [&](size_t i)
+                  {
+                      hit_record rec;
+                      do_not_optimize(target.hit(away[i & (pool_size - 1)], 0, infinity, rec)); });
+    }
+
+    for (size_t n : {1, 10, 100, 1000, 10000})
+    {
+        auto list = make_spheres(n, diffuse);
+        auto rays = make_rays(std::sqrt(static_cast<double>(n)) / 2);
+
+        bench.run("hittable_list::hit/" + std::to_string(n), [&](size_t i)
+                  {
+                      hit_record rec;
+                      do_not_optimize(list.hit(rays[i & (pool_size - 1)], 0, infinity, rec));
+                      do_not_optimize(rec); });
+
+        bvh tree(list);
+        bench.run("bvh::hit/" + std::to_string(n), [&](size_t i)
+                  {
+                      hit_record rec;
+                      do_not_optimize(tree.hit(rays[i & (pool_size - 1)], 0, infinity, rec));
+                      do_not_optimize(rec); });
+        bench.run("bvh::occluded/" + std::to_string(n), [&](size_t i)
+                  { do_not_optimize(tree.occluded(rays[i & (pool_size - 1)], 0, infinity)); });
+
+        auto set = make_sphere_set(list);
+        bench.run("sphere_set::hit/" + std::to_string(n), [&](size_t i)
+                  {
+                      hit_record rec;
+                      do_not_optimize(set->hit(rays[i & (pool_size - 1)], 0, infinity, rec));
+                      do_not_optimize(rec); });
+        bench.run("sphere_set::occluded/" + std::to_string(n), [&](size_t i)
+                  { do_not_optimize(set->occluded(rays[i & (pool_size - 1)], 0, infinity)); });
+    }
+
+    // Primary rays: 4x4 pixel blocks spread over a 1920x1080 frame, one by one and as packets
+    {
+        auto list = make_spheres(1000, diffuse);
+        bvh tree(list);
+        camera cam(point3(0, 1, 10), point3(0, 0, 0), vec3(0, 1, 0), 20, 16.0 / 9.0, 0.1, 10.0);
+        std::vector<ray> rays;
+        for (size_t block = 0; block < pool_size / 16; block++)
+        {
+            auto x0 = static_cast<int>(block % 16) * 120;
+            auto y0 = static_cast<int>(block / 16) * 67;
+            for (int k = 0; k < 16; k++)
+            {
+                rays.push_back(cam.get_ray((x0 + k % 4) / 1919.0, (y0 + k / 4) / 1079.0));
+            }
+        }
+
+        bench.run("bvh::hit/primary", [&](size_t i)
+                  {
+                      hit_record rec;
+                      do_not_optimize(tree.hit(rays[i & (pool_size - 1)], 0, infinity, rec));
+                      do_not_optimize(rec); });
+
+        for (int size : {4, 8, 16})
+        {
+            std::vector<ray_packet> packets(pool_size / size);
+            for (size_t k = 0; k < pool_size; k++)
+            {
+                packets[k / size].size = size;
+                packets[k / size].set(static_cast<int>(k % size), rays[k]);
+            }
+            bench.run("bvh::hit_packet/primary/" + std::to_string(size), [&](size_t i)
+                      {
+                          packet_hit hits;
+                          tree.hit_packet(packets[i % packets.size()], 0, hits);
+                          do_not_optimize(hits); },
+                      size);
+        }
+    }
+
+    // Shading
+    {
+        sphere target(point3(0, 0, 0), 1.0, diffuse);
+        auto rays = make_rays(0.5);
+        std::vector<std::pair<ray, hit_record>> hits;
+        for (const auto &r : rays)
+        {
+            hit_record rec;
+            if (target.hit(r, 0, infinity, rec))
+            {
+                hits.emplace_back(r, rec);
+            }
+        }
+        // Round down to a power of two so that inputs can be cycled with a mask.
+        size_t mask = 1;
+        while (mask * 2 <= hits.size())
+        {
+            mask *= 2;
+        }
+        mask -= 1;
+
+        material diffuse_material = lambertian(color(0.5, 0.5, 0.5));
+        material metal_material = metal(color(0.7, 0.6, 0.5), 0.3);
+        material glass_material = dielectric(1.5);
+        const std::pair<const char *, const material *> shaders[] = {
+            {"lambertian::scatter", &diffuse_material},
+            {"metal::scatter", &metal_material},
+            {"dielectric::scatter", &glass_material},
+        };
+        for (const auto &shader : shaders)
+        {
+            bench.run(shader.first, [&](size_t i)
+                      {
+                          const auto &h = hits[i & mask];
+                          color attenuation;
+                          ray scattered;
+                          do_not_optimize(shader.second->scatter(h.first, h.second, attenuation, scattered));
+                          do_not_optimize(scattered); });
+        }
+    }
+
+    // Sampling
+    bench.run("vec3::random_in_unit_sphere", [](size_t)
+              { do_not_optimize(vec3::random_in_unit_sphere()); });
+    bench.run("vec3::random_in_unit_disk", [](size_t)
+              { do_not_optimize(vec3::random_in_unit_disk()); });
+    for (auto type : {sampler_type::sobol, sampler_type::blue_noise})
+    {
+        const sampler source(type);
+        const auto seed = source.pixel_seed(3, 5);
+        bench.run(std::string("sampler::sample_pair/") + sampler_name(type), [&](size_t i)
+                  {
+                      uint32_t pair[2];
+                      source.sample_pair(3, 5, seed, static_cast<uint32_t>(i >> 4), i & 15, pair);
+                      do_not_optimize(pair[0]);
+                      do_not_optimize(pair[1]); });
+    }
+
+    {
+        camera cam(point3(0, 1, 10), point3(0, 0, 0), vec3(0, 1, 0), 20, 16.0 / 9.0, 0.1, 10.0);
+        bench.run("camera::get_ray", [&](size_t i)
+                  {
+                      auto s = (i & 1023) / 1023.0;
+                      auto t = ((i >> 10) & 1023) / 1023.0;
+                      do_not_optimize(cam.get_ray(s, t)); });
+    }
+
+    return 0;
+}
@@ -11,10 +11,10 @@ public:
             point3 lookfrom,
             point3 lookat,
             vec3 vup,
-            double vfov, // vertical field-of-view in degrees
-            double aspect_ratio,
-            double aperture,
-            double focus_dist)
+            real vfov, // vertical field-of-view in degrees
+            real aspect_ratio,
+            real aperture,
+            real focus_dist)
     {
         auto theta = degrees_to_radians(vfov);
         auto h = tan(theta / 2);
@@ -33,7 +33,7 @@ public:
         this->lens_radius = aperture / 2;
     }
 
-    ray get_ray(double s, double t)
+    RT_HOT ray get_ray(real s, real t) const
     {
         vec3 rd = lens_radius * vec3::random_in_unit_disk();
         vec3 offset = u * rd.x() + v * rd.y();
@@ -49,7 +49,7 @@ private:
     vec3 vertical;
     point3 lower_left_corner;
 
-    double lens_radius;
+    real lens_radius;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,143 @@
+#pragma once
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include "integrator.hpp"
+#include "utils/temp_file.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Settings a checkpoint was rendered with; resuming needs the same ones.
+ *
+ * Samples seed their generator from the pixel and sample index, so the
+ * per-pixel sample counts are the whole random state of a render.
+ */
+struct checkpoint_info
+{
+    int32_t width = 0;
+    int32_t height = 0;
+    int32_t scene = 0; // 0 random, 1 small, 2 night
+    int32_t grid = 0;
+    int32_t max_depth = 0;
+    int32_t roulette_depth = 0;
+    int32_t sampler = 0;
+
+    bool operator==(const checkpoint_info &other) const
+    {
+        return width == other.width && height == other.height && scene == other.scene &&
+               grid == other.grid && max_depth == other.max_depth && roulette_depth == other.roulette_depth &&
+               sampler == other.sampler;
+    }
+    bool operator!=(const checkpoint_info &other) const { return !(*this == other); }
+};
+
+namespace checkpoint_format
+{
+    constexpr char magic[8] = {'R', 'T', 'C', 'K', 'P', 'T', '0', '3'};
+
+    // Per pixel: sample count, radiance sum and luminance statistics, in host byte order.
+    // Also the wire format of pixels sent between processes.
+    struct pixel_record
+    {
+        uint32_t count;
+        uint32_t padding;
+        double sum[3];
+        double mean;
+        double m2;
+    };
+
+    inline pixel_record to_record(const pixel_accumulator &acc)
+    {
+        return {static_cast<uint32_t>(acc.count), 0, {acc.sum.x(), acc.sum.y(), acc.sum.z()}, acc.mean, acc.m2};
+    }
+
+    inline pixel_accumulator from_record(const pixel_record &r)
+    {
+        pixel_accumulator acc;
+        acc.count = static_cast<int>(r.count);
+        acc.sum = color(r.sum[0], r.sum[1], r.sum[2]);
+        acc.mean = r.mean;
+        acc.m2 = r.m2;
+        return acc;
+    }
+} // namespace checkpoint_format
+
+/**
+ * @brief Write the accumulation state of a render, rows as the integrators index them.
+ * The file is written next to path and renamed over it, so a crash while
+ * writing leaves the previous checkpoint intact.
+ */
+inline bool write_checkpoint(const std::string &path, const checkpoint_info &info,
+                             const std::vector<pixel_accumulator> &pixels)
+{
+    auto temporary = create_temporary(path);
+    if (temporary.empty())
+    {
+        return false;
+    }
+    {
+        std::ofstream file(temporary, std::ios::out | std::ios::binary | std::ios::trunc);
+        file.write(checkpoint_format::magic, sizeof(checkpoint_format::magic));
+        file.write(reinterpret_cast<const char *>(&info), sizeof(info));
+
+        std::vector<checkpoint_format::pixel_record> records(pixels.size());
+        for (size_t k = 0; k < pixels.size(); k++)
+        {
+            records[k] = checkpoint_format::to_record(pixels[k]);
+        }
+        file.write(reinterpret_cast<const char *>(records.data()),
+                   static_cast<std::streamsize>(records.size() * sizeof(records[0])));
+        file.flush();
+        if (!file)
+        {
+            std::remove(temporary.c_str());
+            return false;
+        }
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Load a checkpoint written by write_checkpoint.
+ * @return false if the file is missing, truncated or not a checkpoint
+ */
+inline bool read_checkpoint(const std::string &path, checkpoint_info &info, std::vector<pixel_accumulator> &pixels)
+{
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    char magic[sizeof(checkpoint_format::magic)];
+    file.read(magic, sizeof(magic));
+    file.read(reinterpret_cast<char *>(&info), sizeof(info));
+    if (!file || std::memcmp(magic, checkpoint_format::magic, sizeof(magic)) != 0 || info.width <= 0 ||
+        info.height <= 0)
+    {
+        return false;
+    }
+
+    std::vector<checkpoint_format::pixel_record> records(static_cast<size_t>(info.width) * info.height);
+    file.read(reinterpret_cast<char *>(records.data()),
+              static_cast<std::streamsize>(records.size() * sizeof(records[0])));
+    if (!file)
+    {
+        return false;
+    }
+
+    pixels.resize(records.size());
+    for (size_t k = 0; k < records.size(); k++)
+    {
+        pixels[k] = checkpoint_format::from_record(records[k]);
+    }
+    return true;
+}
+
+#endif
@@ -11,8 +11,11 @@
 #include <cmath>
 #include <limits>
 #include <memory>
-#include <cstdlib>
-#include <random>
+
+#include "utils/real.hpp"
+#include "utils/rng.hpp"
+#include "utils/sampler.hpp"
+#include "utils/stats.hpp"
 
 // Using
 
@@ -21,29 +24,29 @@ using std::shared_ptr;
 using std::sqrt;
 
 // Constants
-const double infinity = std::numeric_limits<double>::infinity();
-const double pi = 3.1415926535897932385;
+const real infinity = std::numeric_limits<real>::infinity();
+const real pi = 3.1415926535897932385;
 
 // Utility Functions
 
-inline double degrees_to_radians(double degrees)
+inline real degrees_to_radians(real degrees)
 {
     return degrees * pi / 180.0;
 }
 
-// @brief Returns a random real in [0,1).
-inline double random_double()
+// @brief Returns a random real in [0,1), the next number of the thread's sample stream.
+inline real random_double()
 {
-    return rand() / (RAND_MAX + 1.0);
+    return thread_samples().next();
 }
 
 // @brief Returns a random real in [min,max]
-inline double random_double(double min, double max)
+inline real random_double(real min, real max)
 {
     return min + (max - min) * random_double();
 }
 
-inline double clamp(double x, double min, double max)
+inline real clamp(real x, real min, real max)
 {
     if (x < min)
     {
@@ -60,6 +63,7 @@ inline double clamp(double x, double min, double max)
 
 #include "utils/vec3.hpp"
 #include "utils/ray.hpp"
+#include "utils/aabb.hpp"
 #include "utils/hittable.hpp"
 #include "utils/material.hpp"
 
@@ -0,0 +1,283 @@
+#pragma once
+#ifndef DENOISE_HPP
+#define DENOISE_HPP
+
+#include "integrator.hpp"
+#include "utils/thread_pool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/**
+ * @brief Features of the surface seen in each pixel, rows as the integrators index them.
+ * Averaged over the first samples of the pixel, the same camera rays the
+ * render traced, so edges are antialiased like the image.
+ */
+struct aov_buffers
+{
+    std::vector<color> normal; // unit length, zero where every ray missed
+    std::vector<color> albedo; // tint of any mirrors on the way, alone for rays that missed
+    std::vector<float> depth;  // mean distance to the hits, zero where every ray missed
+};
+
+// Camera rays per pixel the feature buffers are averaged over.
+constexpr int aov_samples = 4;
+
+/**
+ * @brief Follow r through glass and smooth metal to the first rough surface.
+ * Features of a mirror-like hit say nothing of what is seen in it, so the
+ * buffers describe the surface seen instead, its albedo tinted by the mirrors
+ * on the way and its depth the length of the whole path. Glass is followed by
+ * refraction where it refracts at all, so the choice stays deterministic.
+ * @return false if the path leaves the scene, albedo then holds the tint
+ */
+inline bool first_rough_hit(const frame_context &frame, ray r, hit_record &rec, color &albedo, real &distance)
+{
+    constexpr int max_mirrors = 8;
+    constexpr real smooth_fuzz = 0.1;
+    albedo = color(1, 1, 1);
+    distance = 0;
+    for (int bounce = 0;; bounce++)
+    {
+        if (!frame.world.hit(r, 0, infinity, rec))
+        {
+            return false;
+        }
+        distance += rec.t * r.direction().length();
+        const auto &m = *rec.mat_ptr;
+        const auto unit_direction = r.direction().unit_vector();
+        vec3 direction;
+        if (bounce < max_mirrors && m.type() == material_type::dielectric)
+        {
+            auto ir = m.as<dielectric>().get_index_of_refraction();
+            real ratio = rec.front_face ? (1.0 / ir) : ir;
+            real cos_theta = fmin((-unit_direction).dot(rec.normal), 1.0);
+            bool cannot_refract = ratio * sqrt(1.0 - cos_theta * cos_theta) > 1.0;
+            direction = cannot_refract ? reflect(unit_direction, rec.normal)
+                                       : refract(unit_direction, rec.normal, ratio);
+        }
+        else if (bounce < max_mirrors && m.type() == material_type::metal &&
+                 m.as<metal>().get_fuzz() < smooth_fuzz)
+        {
+            albedo = albedo * m.as<metal>().get_albedo();
+            direction = reflect(unit_direction, rec.normal);
+        }
+        else
+        {
+            albedo = albedo * m.albedo();
+            return true;
+        }
+        r = rec.spawn_ray(direction);
+    }
+}
+
+/**
+ * @brief Trace the first aov_samples camera rays of every pixel to their first rough hit.
+ * Nothing is counted into the render statistics.
+ */
+inline void render_aovs(const frame_context &frame, thread_pool &pool, aov_buffers &aovs)
+{
+    const auto width = frame.image_width;
+    const auto count = static_cast<size_t>(width) * frame.image_height;
+    const auto samples = std::max(1, std::min(aov_samples, frame.samples_per_pixel));
+    aovs.normal.assign(count, color(0, 0, 0));
+    aovs.albedo.assign(count, color(0, 0, 0));
+    aovs.depth.assign(count, 0.0f);
+
+    pool.parallel_for(
+        static_cast<size_t>(frame.image_height),
+        [&](size_t row, unsigned)
+        {
+            const auto i = static_cast<int>(row);
+            for (int j = 0; j < width; j++)
+            {
+                color normal(0, 0, 0), albedo(0, 0, 0);
+                real depth = 0;
+                int hits = 0;
+                for (int s = 0; s < samples; s++)
+                {
+                    hit_record rec;
+                    color tint;
+                    real distance;
+                    if (first_rough_hit(frame, camera_ray(frame, i, j, s), rec, tint, distance))
+                    {
+                        normal += rec.normal;
+                        depth += distance;
+                        hits++;
+                    }
+                    albedo += tint;
+                }
+                const auto k = static_cast<size_t>(i) * width + j;
+                aovs.normal[k] = hits > 0 && normal.length_squared() > 0 ? normal.unit_vector() : color(0, 0, 0);
+                aovs.albedo[k] = albedo / samples;
+                aovs.depth[k] = hits > 0 ? static_cast<float>(depth / hits) : 0.0f;
+            }
+        });
+}
+
+/**
+ * @brief Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010), with
+ * the luminance edge-stopping of SVGF (Schied et al. 2017).
+ *
+ * The radiance is divided by the albedo first, so that only the lighting is
+ * blurred, and multiplied back at the end. Five passes of a 5x5 B3-spline
+ * kernel at taps 1, 2, 4, 8 and 16 pixels apart cover a 61 pixel footprint.
+ * Neighbours count less the more their normal, depth (against the local depth
+ * slope) or luminance differs; the luminance tolerance follows the standard
+ * error of each pixel, from the statistics the accumulators keep, and is
+ * filtered along with the image. Rows are spread over the pool.
+ * @return the denoised radiance of each pixel, rows as in accumulators
+ */
+inline std::vector<color> denoise(const std::vector<pixel_accumulator> &accumulators, const aov_buffers &aovs,
+                                  int width, int height, thread_pool &pool)
+{
+    constexpr int passes = 5;
+    constexpr real albedo_epsilon = 0.001;
+    constexpr float sigma_depth = 1.0f;
+    constexpr float sigma_luminance = 4.0f;
+    constexpr float kernel[5] = {1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16};
+
+    const auto count = static_cast<size_t>(width) * height;
+    auto luminance = [](const color &c)
+    { return static_cast<float>(0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z()); };
+    auto demodulator = [&](size_t k)
+    { return aovs.albedo[k] + color(albedo_epsilon, albedo_epsilon, albedo_epsilon); };
+
+    std::vector<color> lighting(count), next_lighting(count);
+    std::vector<float> variance(count), next_variance(count);
+    std::vector<float> slope_x(count), slope_y(count);
+    pool.parallel_for(
+        static_cast<size_t>(height),
+        [&](size_t row, unsigned)
+        {
+            const auto i = static_cast<int>(row);
+            for (int j = 0; j < width; j++)
+            {
+                const auto k = static_cast<size_t>(i) * width + j;
+                const auto &acc = accumulators[k];
+                auto radiance = acc.count > 0 ? acc.sum / acc.count : color(0, 0, 0);
+                auto a = demodulator(k);
+                lighting[k] = color(radiance.x() / a.x(), radiance.y() / a.y(), radiance.z() / a.z());
+                // Of the mean, an unknown one as large as a pixel's whole range
+                variance[k] = acc.count > 1 ? static_cast<float>(acc.m2 / (acc.count - 1) / acc.count) : 1.0f;
+
+                // Depth change per pixel, from the smoother side so that silhouettes stay sharp
+                auto slope = [&](int di, int dj)
+                {
+                    float best = 0;
+                    bool found = false;
+                    for (int side : {-1, 1})
+                    {
+                        int ni = i + side * di, nj = j + side * dj;
+                        if (ni >= 0 && ni < height && nj >= 0 && nj < width &&
+                            aovs.normal[static_cast<size_t>(ni) * width + nj].length_squared() > 0)
+                        {
+                            auto d = std::fabs(aovs.depth[static_cast<size_t>(ni) * width + nj] - aovs.depth[k]);
+                            best = found ? std::min(best, d) : d;
+                            found = true;
+                        }
+                    }
+                    return best;
+                };
+                slope_x[k] = slope(0, 1);
+                slope_y[k] = slope(1, 0);
+            }
+        });
+
+    for (int pass = 0, step = 1; pass < passes; pass++, step *= 2)
+    {
+        pool.parallel_for(
+            static_cast<size_t>(height),
+            [&](size_t row, unsigned)
+            {
+                const auto i = static_cast<int>(row);
+                for (int j = 0; j < width; j++)
+                {
+                    const auto p = static_cast<size_t>(i) * width + j;
+                    const auto &normal_p = aovs.normal[p];
+                    const bool miss_p = normal_p.length_squared() == 0;
+                    const auto depth_p = aovs.depth[p];
+                    const auto luminance_p = luminance(lighting[p] * demodulator(p));
+
+                    // Luminance tolerance from the variance, prefiltered 3x3 as SVGF does
+                    float blurred = 0, blurred_weight = 0;
+                    for (int di = -1; di <= 1; di++)
+                    {
+                        for (int dj = -1; dj <= 1; dj++)
+                        {
+                            int ni = i + di, nj = j + dj;
+                            if (ni >= 0 && ni < height && nj >= 0 && nj < width)
+                            {
+                                float w = kernel[di + 2] * kernel[dj + 2];
+                                blurred += w * variance[static_cast<size_t>(ni) * width + nj];
+                                blurred_weight += w;
+                            }
+                        }
+                    }
+                    const auto tolerance = sigma_luminance * std::sqrt(blurred / blurred_weight) + 1e-6f;
+
+                    color sum(0, 0, 0);
+                    float weight_sum = 0, variance_sum = 0;
+                    for (int di = -2; di <= 2; di++)
+                    {
+                        const int qi = i + di * step;
+                        if (qi < 0 || qi >= height)
+                        {
+                            continue;
+                        }
+                        for (int dj = -2; dj <= 2; dj++)
+                        {
+                            const int qj = j + dj * step;
+                            if (qj < 0 || qj >= width)
+                            {
+                                continue;
+                            }
+                            const auto q = static_cast<size_t>(qi) * width + qj;
+                            float w = kernel[di + 2] * kernel[dj + 2];
+                            if (q != p)
+                            {
+                                const auto &normal_q = aovs.normal[q];
+                                const bool miss_q = normal_q.length_squared() == 0;
+                                if (miss_p != miss_q)
+                                {
+                                    continue;
+                                }
+                                float exponent = std::fabs(luminance(lighting[q] * demodulator(q)) - luminance_p) /
+                                                 tolerance;
+                                if (!miss_p)
+                                {
+                                    // max(0, n_p . n_q)^32
+                                    auto n = static_cast<float>(std::max(static_cast<real>(0), normal_p.dot(normal_q)));
+                                    for (int square = 0; square < 5; square++)
+                                    {
+                                        n *= n;
+                                    }
+                                    w *= n;
+                                    auto expected = step * (std::abs(dj) * slope_x[p] + std::abs(di) * slope_y[p]);
+                                    exponent += std::fabs(aovs.depth[q] - depth_p) /
+                                                (sigma_depth * expected + 1e-3f * depth_p + 1e-6f);
+                                }
+                                w *= std::exp(-exponent);
+                            }
+                            sum += w * lighting[q];
+                            weight_sum += w;
+                            variance_sum += w * w * variance[q];
+                        }
+                    }
+                    next_lighting[p] = sum / weight_sum;
+                    next_variance[p] = variance_sum / (weight_sum * weight_sum);
+                }
+            });
+        lighting.swap(next_lighting);
+        variance.swap(next_variance);
+    }
+
+    for (size_t k = 0; k < count; k++)
+    {
+        lighting[k] = lighting[k] * demodulator(k);
+    }
+    return lighting;
+}
+
+#endif
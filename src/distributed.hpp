@@ -0,0 +1,411 @@
+#pragma once
+#ifndef DISTRIBUTED_HPP
+#define DISTRIBUTED_HPP
+
+#include "checkpoint.hpp"
+#include "utils/progress.hpp"
+#include "utils/stats.hpp"
+#include "utils/tile.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/**
+ * Messages between the coordinator and its workers, over a stream socket.
+ * Fixed-size headers in host byte order, followed by pixel_records and, in
+ * results, packed render_stats counters. Nothing in them refers to the
+ * process that sent them, so a worker could as well sit behind a TCP socket.
+ */
+namespace tile_protocol
+{
+    constexpr uint32_t quit = 0xffffffff; // tile index that tells a worker to exit
+
+    // Raise tile to target samples per pixel, starting from the pixel_records that follow.
+    struct task_header
+    {
+        uint32_t tile;
+        int32_t target;
+        uint32_t pixels;
+        uint32_t padding;
+    };
+
+    // Followed by counters packed render_stats values, then the tile's pixel_records.
+    struct result_header
+    {
+        uint32_t tile;
+        uint32_t pixels;
+        uint32_t counters;
+        uint32_t padding;
+        double seconds;
+    };
+
+    // @brief Write all of data, false once the peer is gone.
+    inline bool send_all(int fd, const void *data, size_t size)
+    {
+        auto *bytes = static_cast<const char *>(data);
+        while (size > 0)
+        {
+            auto n = ::send(fd, bytes, size, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                return false;
+            }
+            bytes += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    // @brief Read exactly size bytes, false on end of stream or error.
+    inline bool recv_all(int fd, void *data, size_t size)
+    {
+        auto *bytes = static_cast<char *>(data);
+        while (size > 0)
+        {
+            auto n = ::recv(fd, bytes, size, 0);
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                return false;
+            }
+            bytes += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+} // namespace tile_protocol
+
+// @brief Continues the tile-local accumulators of a tile up to a per-pixel sample target.
+using tile_renderer = std::function<void(const tile &t, int target, std::vector<pixel_accumulator> &pixels)>;
+
+/**
+ * @brief Worker side of the protocol: render the tiles sent over fd until told
+ * to quit or the coordinator is gone. Counters are collected per tile and sent
+ * back with it, so the work of a worker that later dies is still accounted for.
+ */
+inline void serve_tiles(int fd, const std::vector<tile> &tiles, int max_depth, const tile_renderer &render)
+{
+    std::vector<checkpoint_format::pixel_record> records;
+    std::vector<pixel_accumulator> pixels;
+    for (;;)
+    {
+        tile_protocol::task_header task;
+        if (!tile_protocol::recv_all(fd, &task, sizeof(task)) || task.tile >= tiles.size() ||
+            task.pixels != static_cast<uint32_t>(tiles[task.tile].pixel_count()))
+        {
+            return;
+        }
+        records.resize(task.pixels);
+        if (!tile_protocol::recv_all(fd, records.data(), records.size() * sizeof(records[0])))
+        {
+            return;
+        }
+        pixels.resize(records.size());
+        uint64_t samples_before = 0;
+        for (size_t k = 0; k < records.size(); k++)
+        {
+            pixels[k] = checkpoint_format::from_record(records[k]);
+            samples_before += pixels[k].count;
+        }
+
+        render_stats stats(max_depth);
+        render_stats::current() = &stats;
+        auto tile_start = std::chrono::steady_clock::now();
+        render(tiles[task.tile], task.target, pixels);
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tile_start).count();
+        render_stats::current() = nullptr;
+
+        for (size_t k = 0; k < pixels.size(); k++)
+        {
+            records[k] = checkpoint_format::to_record(pixels[k]);
+            stats.samples += pixels[k].count;
+        }
+        stats.samples -= samples_before;
+        auto counters = stats.pack();
+
+        tile_protocol::result_header result{task.tile, task.pixels, static_cast<uint32_t>(counters.size()), 0, seconds};
+        if (!tile_protocol::send_all(fd, &result, sizeof(result)) ||
+            !tile_protocol::send_all(fd, counters.data(), counters.size() * sizeof(counters[0])) ||
+            !tile_protocol::send_all(fd, records.data(), records.size() * sizeof(records[0])))
+        {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Renders passes on worker processes forked from the calling process.
+ *
+ * Each worker gets one end of a socket pair and runs serve(fd); the scene is
+ * shared through fork, only tiles and their accumulators travel. Tiles go to
+ * whichever worker is idle, one at a time, so faster workers take more of
+ * them. A worker that exits or breaks the protocol is reaped and its tile is
+ * handed to the next idle worker.
+ */
+class tile_coordinator
+{
+public:
+    tile_coordinator(unsigned count, const std::function<void(int fd)> &serve)
+    {
+        std::fflush(stdout);
+        std::fflush(stderr);
+        for (unsigned w = 0; w < count; w++)
+        {
+            int ends[2];
+            if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, ends) != 0)
+            {
+                break;
+            }
+            auto pid = ::fork();
+            if (pid < 0)
+            {
+                ::close(ends[0]);
+                ::close(ends[1]);
+                break;
+            }
+            if (pid == 0)
+            {
+                // Interrupts are the coordinator's business, it lets running tiles finish.
+                std::signal(SIGINT, SIG_IGN);
+                std::signal(SIGTERM, SIG_IGN);
+                // Drop the coordinator ends of earlier workers, or they would not see it exit.
+                for (const auto &other : workers)
+                {
+                    ::close(other.fd);
+                }
+                ::close(ends[0]);
+                serve(ends[1]);
+                ::_exit(0);
+            }
+            ::close(ends[1]);
+            workers.push_back({pid, ends[0], -1});
+        }
+    }
+
+    ~tile_coordinator()
+    {
+        for (auto &w : workers)
+        {
+            if (w.fd >= 0)
+            {
+                tile_protocol::task_header task{tile_protocol::quit, 0, 0, 0};
+                tile_protocol::send_all(w.fd, &task, sizeof(task));
+                ::close(w.fd);
+                ::waitpid(w.pid, nullptr, 0);
+            }
+        }
+    }
+
+    tile_coordinator(const tile_coordinator &) = delete;
+    tile_coordinator &operator=(const tile_coordinator &) = delete;
+
+    // @brief Workers still alive.
+    unsigned size() const
+    {
+        unsigned live = 0;
+        for (const auto &w : workers)
+        {
+            live += w.fd >= 0;
+        }
+        return live;
+    }
+
+    /**
+     * @brief Raise every tile to target samples per pixel in the image-wide accumulators.
+     * Once stop() returns true no new tiles are handed out, running ones are still collected;
+     * skipped is raised by the number of tiles left out.
+     * @return false if all workers died before the pass was done
+     */
+    bool render_pass(const std::vector<tile> &tiles, int image_width, int target,
+                     std::vector<pixel_accumulator> &accumulators, render_stats &stats, progress_reporter &progress,
+                     const std::function<bool()> &stop, size_t &skipped)
+    {
+        std::deque<size_t> pending;
+        for (size_t index = 0; index < tiles.size(); index++)
+        {
+            pending.push_back(index);
+        }
+
+        std::vector<pollfd> fds;
+        std::vector<worker *> busy;
+        for (;;)
+        {
+            for (auto &w : workers)
+            {
+                if (w.fd >= 0 && w.tile < 0 && !pending.empty() && !stop())
+                {
+                    auto index = pending.front();
+                    pending.pop_front();
+                    // The worker holds the tile from here, lose() puts it back
+                    w.tile = static_cast<long>(index);
+                    if (!send_task(w, tiles, index, image_width, target, accumulators))
+                    {
+                        lose(w, pending);
+                    }
+                }
+            }
+            if (stop())
+            {
+                // Skipped tiles keep their state, the checkpoint stays consistent.
+                progress.advance(pending.size());
+                skipped += pending.size();
+                pending.clear();
+            }
+
+            fds.clear();
+            busy.clear();
+            for (auto &w : workers)
+            {
+                if (w.fd >= 0 && w.tile >= 0)
+                {
+                    fds.push_back({w.fd, POLLIN, 0});
+                    busy.push_back(&w);
+                }
+            }
+            if (busy.empty())
+            {
+                return pending.empty();
+            }
+
+            if (::poll(fds.data(), fds.size(), -1) < 0)
+            {
+                // Interrupted, possibly by a stop request.
+                continue;
+            }
+            for (size_t k = 0; k < fds.size(); k++)
+            {
+                if (fds[k].revents == 0)
+                {
+                    continue;
+                }
+                auto &w = *busy[k];
+                if (receive_result(w, tiles, image_width, accumulators, stats))
+                {
+                    w.tile = -1;
+                    progress.advance();
+                }
+                else
+                {
+                    lose(w, pending);
+                }
+            }
+        }
+    }
+
+private:
+    struct worker
+    {
+        pid_t pid;
+        int fd;    // -1 once the worker is gone
+        long tile; // index of the tile in flight, -1 when idle
+    };
+
+    std::vector<worker> workers;
+    std::vector<checkpoint_format::pixel_record> records;
+    std::vector<uint64_t> counters;
+
+    bool send_task(const worker &w, const std::vector<tile> &tiles, size_t index, int image_width, int target,
+                   const std::vector<pixel_accumulator> &accumulators)
+    {
+        const auto &t = tiles[index];
+        records.resize(t.pixel_count());
+        for (int i = t.y0; i < t.y1; i++)
+        {
+            for (int j = t.x0; j < t.x1; ++j)
+            {
+                records[(i - t.y0) * t.width() + (j - t.x0)] =
+                    checkpoint_format::to_record(accumulators[i * image_width + j]);
+            }
+        }
+        tile_protocol::task_header task{static_cast<uint32_t>(index), target, static_cast<uint32_t>(records.size()), 0};
+        return tile_protocol::send_all(w.fd, &task, sizeof(task)) &&
+               tile_protocol::send_all(w.fd, records.data(), records.size() * sizeof(records[0]));
+    }
+
+    bool receive_result(const worker &w, const std::vector<tile> &tiles, int image_width,
+                        std::vector<pixel_accumulator> &accumulators, render_stats &stats)
+    {
+        const auto &t = tiles[w.tile];
+        tile_protocol::result_header result;
+        if (!tile_protocol::recv_all(w.fd, &result, sizeof(result)) || result.tile != static_cast<uint32_t>(w.tile) ||
+            result.pixels != static_cast<uint32_t>(t.pixel_count()) || result.counters > (1u << 16))
+        {
+            return false;
+        }
+        counters.resize(result.counters);
+        records.resize(result.pixels);
+        if (!tile_protocol::recv_all(w.fd, counters.data(), counters.size() * sizeof(counters[0])) ||
+            !tile_protocol::recv_all(w.fd, records.data(), records.size() * sizeof(records[0])) ||
+            !stats.merge_packed(counters))
+        {
+            return false;
+        }
+
+        for (int i = t.y0; i < t.y1; i++)
+        {
+            for (int j = t.x0; j < t.x1; ++j)
+            {
+                accumulators[i * image_width + j] =
+                    checkpoint_format::from_record(records[(i - t.y0) * t.width() + (j - t.x0)]);
+            }
+        }
+        stats.tiles.push_back({t.x0, t.y0, t.x1, t.y1, result.seconds});
+        return true;
+    }
+
+    // @brief Reap a failed worker and put its tile back at the front of the queue.
+    void lose(worker &w, std::deque<size_t> &pending)
+    {
+        if (w.tile >= 0)
+        {
+            pending.push_front(static_cast<size_t>(w.tile));
+        }
+        ::close(w.fd);
+        int status = 0;
+        bool killed = false;
+        if (::waitpid(w.pid, &status, WNOHANG) == 0)
+        {
+            // Still running, so it broke the protocol; one already exiting keeps its own status.
+            ::kill(w.pid, SIGKILL);
+            ::waitpid(w.pid, &status, 0);
+            killed = WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL;
+        }
+        if (killed)
+        {
+            std::fprintf(stderr, "\nWorker %d broke the protocol and was killed", static_cast<int>(w.pid));
+        }
+        else if (WIFSIGNALED(status))
+        {
+            std::fprintf(stderr, "\nWorker %d killed by signal %d", static_cast<int>(w.pid), WTERMSIG(status));
+        }
+        else
+        {
+            std::fprintf(stderr, "\nWorker %d exited with status %d", static_cast<int>(w.pid), WEXITSTATUS(status));
+        }
+        std::fprintf(stderr, w.tile >= 0 ? ", its tile goes back to the queue\n" : "\n");
+        w.fd = -1;
+        w.tile = -1;
+    }
+};
+
+#endif
@@ -0,0 +1,613 @@
+#pragma once
+#ifndef INTEGRATOR_HPP
+#define INTEGRATOR_HPP
+
+#include "common.hpp"
+#include "camera.hpp"
+#include "utils/light.hpp"
+#include "utils/tile.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+/**
+ * @brief Frame-wide inputs of a tile render.
+ */
+struct frame_context
+{
+    const camera &cam;
+    const hittable &world;
+    int image_width;
+    int image_height;
+    int samples_per_pixel; // maximum when sampling adaptively
+    int max_depth;
+    int roulette_depth;        // bounces before Russian roulette may end a path
+    int min_samples;           // adaptive sampling only
+    double adaptive_threshold; // 0 disables adaptive sampling
+    const sampler *sampler_ptr; // null for independent samples
+    const light_list *lights = nullptr; // sampled at diffuse hits, null for none
+    real sky_brightness = 1;            // scale of the sky gradient
+};
+
+/**
+ * @brief Radiance sum of one pixel plus running (Welford) statistics of its luminance.
+ */
+struct pixel_accumulator
+{
+    color sum;
+    int count = 0;
+    double mean = 0;
+    double m2 = 0;
+
+    void add(const color &c)
+    {
+        sum += c;
+        count++;
+        auto y = 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+        auto delta = y - mean;
+        mean += delta / count;
+        m2 += delta * (y - mean);
+    }
+
+    /**
+     * @brief Whether the standard error of the mean, seen through the gamma 2 output
+     * transform (d sqrt(x) = dx / 2 sqrt(x)), is below threshold.
+     */
+    bool converged(double threshold) const
+    {
+        if (count < 2)
+        {
+            return false;
+        }
+        auto standard_error = sqrt(m2 / (count - 1) / count);
+        return standard_error < threshold * 2.0 * sqrt(fmax(mean, 1e-4));
+    }
+};
+
+// Adaptive sampling checks a pixel at min_samples and then every this many samples.
+constexpr int adaptive_check_interval = 4;
+
+/**
+ * @brief Sample count a pixel should reach before its next convergence check,
+ * or its current count if it is done.
+ */
+inline int next_sample_target(const frame_context &frame, const pixel_accumulator &acc)
+{
+    if (frame.adaptive_threshold <= 0)
+    {
+        return frame.samples_per_pixel;
+    }
+    if (acc.count < frame.min_samples)
+    {
+        return std::min(frame.min_samples, frame.samples_per_pixel);
+    }
+    if (acc.count >= frame.samples_per_pixel || acc.converged(frame.adaptive_threshold))
+    {
+        return acc.count;
+    }
+    return std::min(acc.count + adaptive_check_interval, frame.samples_per_pixel);
+}
+
+// @brief Background gradient seen by rays that leave the scene.
+inline color sky_color(const ray &r)
+{
+    vec3 unit_direction = r.direction().unit_vector();
+    auto t = 0.5 * (unit_direction.y() + 1.0);
+    return (1.0 - t) * color(1.0, 1.0, 1.0) + t * color(0.5, 0.7, 1.0);
+}
+
+// @brief What rays that leave the scene see.
+inline color background(const frame_context &frame, const ray &r)
+{
+    return frame.sky_brightness * sky_color(r);
+}
+
+/**
+ * @brief Emitted radiance a path picks up where it hits rec. Lights were
+ * already counted by the light sample of the previous bounce if it took one.
+ */
+inline color hit_emission(const hit_record &rec, bool lights_sampled)
+{
+    const auto &m = *rec.mat_ptr;
+    if (lights_sampled && m.type() == material_type::diffuse_light)
+    {
+        return {0, 0, 0};
+    }
+    return m.emitted(rec);
+}
+
+/**
+ * @brief Next-event estimate at a diffuse hit of bounce: the light of one point
+ * sampled on the frame's lights, zero if the way there is blocked; before the albedo.
+ */
+inline color sample_direct_light(const frame_context &frame, const hit_record &rec, int bounce)
+{
+    thread_samples().start_light(bounce);
+    ray shadow;
+    real t_max;
+    color radiance;
+    if (!frame.lights->sample(rec, shadow, t_max, radiance))
+    {
+        return {0, 0, 0};
+    }
+    RT_STAT(shadow_rays++);
+    return frame.world.occluded(shadow, 0, t_max) ? color(0, 0, 0) : radiance;
+}
+
+/**
+ * @brief Unbiased Russian roulette: from roulette_depth bounces on, a path whose
+ * throughput has dropped below 1 is ended with probability 1 - max(throughput),
+ * at most 0.95, and the throughput of the survivors is divided by their chance
+ * of surviving. Draws from the thread's sample stream only when it plays.
+ * @return false if the path ends
+ */
+inline bool russian_roulette(color &throughput, int bounce, int roulette_depth)
+{
+    auto max_component = fmax(throughput.x(), fmax(throughput.y(), throughput.z()));
+    if (bounce < roulette_depth || max_component >= 1)
+    {
+        return true;
+    }
+    auto q = fmin(static_cast<real>(0.95), 1 - max_component);
+    if (random_double() < q)
+    {
+        RT_STAT(roulette_terminations++);
+        RT_STAT(end_path(bounce));
+        return false;
+    }
+    throughput /= 1 - q;
+    return true;
+}
+
+/**
+ * @brief Radiance arriving along the primary ray r, whose closest hit is rec.
+ *
+ * Iterates bounce by bounce carrying the path throughput, so the stack does not
+ * grow with the path. A path ends on a miss, on absorption, by Russian roulette
+ * or after frame.max_depth rays. With lights in the frame, diffuse hits sample
+ * them directly, and the path does not count a light it then hits.
+ */
+RT_HOT color shade_path(ray r, hit_record rec, const frame_context &frame)
+{
+    color radiance(0, 0, 0);
+    color throughput(1, 1, 1);
+    bool lights_sampled = false;
+    for (int bounce = 0;;)
+    {
+        radiance += throughput * hit_emission(rec, lights_sampled);
+        lights_sampled = frame.lights != nullptr && rec.mat_ptr->type() == material_type::lambertian;
+        if (lights_sampled)
+        {
+            radiance += throughput * rec.mat_ptr->as<lambertian>().get_albedo() *
+                        sample_direct_light(frame, rec, bounce);
+        }
+
+        thread_samples().start_bounce(bounce);
+        ray scattered;
+        color attenuation;
+        if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered))
+        {
+            RT_STAT(absorbed++);
+            RT_STAT(end_path(bounce));
+            return radiance;
+        }
+        RT_STAT(scatter_events[static_cast<int>(rec.mat_ptr->type())]++);
+        throughput = throughput * attenuation;
+        bounce++;
+
+        if (!russian_roulette(throughput, bounce, frame.roulette_depth))
+        {
+            return radiance;
+        }
+        // If we've exceeded the ray bounce limit, no more light is gathered.
+        if (bounce >= frame.max_depth)
+        {
+            RT_STAT(max_depth_terminations++);
+            RT_STAT(end_path(bounce));
+            return radiance;
+        }
+
+        r = scattered;
+        RT_STAT(rays_traced++);
+        if (!frame.world.hit(r, 0, infinity, rec))
+        {
+            RT_STAT(end_path(bounce));
+            return radiance + throughput * background(frame, r);
+        }
+    }
+}
+
+RT_HOT color ray_color(const ray &r, const frame_context &frame)
+{
+    hit_record rec;
+    RT_STAT(rays_traced++);
+    if (frame.world.hit(r, 0, infinity, rec))
+    {
+        return shade_path(r, rec, frame);
+    }
+    RT_STAT(end_path(0));
+    return background(frame, r);
+}
+
+/**
+ * @brief Primary ray of sample s of pixel (i, j).
+ * Starts the thread's sample stream, so the rest of the path is keyed by the sample too.
+ */
+inline ray camera_ray(const frame_context &frame, int i, int j, int s)
+{
+    RT_STAT(primary_rays++);
+    thread_samples() = sample_stream(frame.sampler_ptr, j, i, static_cast<uint64_t>(i) * frame.image_width + j, s);
+    auto u = (j + random_double()) / (frame.image_width - 1);
+    auto v = (i + random_double()) / (frame.image_height - 1);
+    return frame.cam.get_ray(u, v);
+}
+
+/**
+ * @brief Depth-first integrator, traces every sample to the end before starting the next.
+ * @param pixels per-pixel estimates of the tile, row-major; they are continued from
+ * their current sample counts, so a tile can be rendered in several passes
+ */
+inline void render_tile_recursive(const frame_context &frame, const tile &t, std::vector<pixel_accumulator> &pixels)
+{
+    for (int i = t.y0; i < t.y1; i++)
+    {
+        for (int j = t.x0; j < t.x1; ++j)
+        {
+            auto &acc = pixels[(i - t.y0) * t.width() + (j - t.x0)];
+            for (auto target = next_sample_target(frame, acc); acc.count < target;
+                 target = next_sample_target(frame, acc))
+            {
+                while (acc.count < target)
+                {
+                    acc.add(ray_color(camera_ray(frame, i, j, acc.count), frame));
+                }
+            }
+        }
+    }
+}
+
+// @brief Sample of a pixel of a tile, the pixel given by its index in the tile.
+struct sample_key
+{
+    uint32_t pixel;
+    int index;
+};
+
+/**
+ * @brief Trace the camera rays of up to ray_packet::max_size samples together to
+ * their first hit, then finish each path on its own with shade_path.
+ */
+RT_HOT void trace_packet(const frame_context &frame, const tile &t, const sample_key *samples, int count,
+                         color *radiance)
+{
+    ray_packet p;
+    p.size = count;
+    sample_stream streams[ray_packet::max_size];
+    for (int k = 0; k < count; k++)
+    {
+        auto i = t.y0 + static_cast<int>(samples[k].pixel) / t.width();
+        auto j = t.x0 + static_cast<int>(samples[k].pixel) % t.width();
+        p.set(k, camera_ray(frame, i, j, samples[k].index));
+        streams[k] = thread_samples();
+    }
+
+    packet_hit hits;
+    RT_STAT(rays_traced += count);
+    frame.world.hit_packet(p, 0, hits);
+
+    for (int k = 0; k < count; k++)
+    {
+        auto r = p.get(k);
+        hit_record rec;
+        // The lane's hit record comes from its closest object alone.
+        if (hits.object[k] != nullptr && hits.object[k]->hit_primitive(r, hits.primitive[k], rec))
+        {
+            thread_samples() = streams[k];
+            radiance[k] = shade_path(r, rec, frame);
+        }
+        else
+        {
+            RT_STAT(end_path(0));
+            radiance[k] = background(frame, r);
+        }
+    }
+}
+
+/**
+ * @brief Depth-first integrator with packets of camera rays.
+ *
+ * The tile is walked in blocks of packet_size pixels (2x2, 4x2 or 4x4). The
+ * samples a block needs are queued sample by sample, so that a packet holds the
+ * same sample of neighbouring pixels, and traced packet_size at a time. Paths
+ * diverge after the first bounce and continue as single rays, so the image is
+ * the one the recursive integrator renders.
+ */
+inline void render_tile_packet(const frame_context &frame, const tile &t, int packet_size,
+                               std::vector<pixel_accumulator> &pixels)
+{
+    constexpr int max_size = ray_packet::max_size;
+    packet_size = std::max(1, std::min(packet_size, max_size));
+    const int block_w = packet_size >= 8 ? 4 : packet_size >= 2 ? 2 : 1;
+    const int block_h = std::max(1, packet_size / block_w);
+
+    sample_key queued[max_size];
+    color radiance[max_size];
+    int queued_count = 0;
+    auto flush = [&]()
+    {
+        trace_packet(frame, t, queued, queued_count, radiance);
+        for (int k = 0; k < queued_count; k++)
+        {
+            pixels[queued[k].pixel].add(radiance[k]);
+        }
+        queued_count = 0;
+    };
+
+    for (int by = t.y0; by < t.y1; by += block_h)
+    {
+        for (int bx = t.x0; bx < t.x1; bx += block_w)
+        {
+            uint32_t block[max_size];
+            int n = 0;
+            for (int i = by; i < std::min(by + block_h, t.y1); i++)
+            {
+                for (int j = bx; j < std::min(bx + block_w, t.x1); j++)
+                {
+                    block[n++] = static_cast<uint32_t>((i - t.y0) * t.width() + (j - t.x0));
+                }
+            }
+
+            // Each round queues the samples every unfinished pixel needs before its next check.
+            while (true)
+            {
+                int first[max_size], target[max_size];
+                int lowest = frame.samples_per_pixel, highest = 0;
+                for (int b = 0; b < n; b++)
+                {
+                    first[b] = pixels[block[b]].count;
+                    target[b] = next_sample_target(frame, pixels[block[b]]);
+                    if (first[b] < target[b])
+                    {
+                        lowest = std::min(lowest, first[b]);
+                        highest = std::max(highest, target[b]);
+                    }
+                }
+                if (highest == 0)
+                {
+                    break;
+                }
+
+                for (int s = lowest; s < highest; s++)
+                {
+                    for (int b = 0; b < n; b++)
+                    {
+                        if (first[b] <= s && s < target[b])
+                        {
+                            queued[queued_count++] = {block[b], s};
+                            if (queued_count == packet_size)
+                            {
+                                flush();
+                            }
+                        }
+                    }
+                }
+                if (queued_count > 0)
+                {
+                    flush();
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Breadth-first (wavefront) integrator.
+ *
+ * Camera rays of a tile are generated in batches and advanced one bounce at a
+ * time: the whole batch is intersected, hits are grouped by material type,
+ * each group is shaded by its own devirtualized loop, and surviving paths are
+ * compacted for the next bounce. Shadow rays of the light samples taken at
+ * diffuse hits are queued and tested as one stream after shading. Every path carries its own sample stream, so it
+ * draws the same numbers it would in the recursive integrator.
+ * Instances hold scratch buffers, use one per worker thread. Like the other
+ * integrators it continues the estimates it is given.
+ */
+class wavefront_integrator
+{
+public:
+    explicit wavefront_integrator(size_t batch_size = 8192) : batch_size(batch_size) {}
+
+    void render_tile(const frame_context &frame, const tile &t, std::vector<pixel_accumulator> &pixels);
+
+private:
+    struct path
+    {
+        ray r;
+        color throughput;
+        sample_stream samples;
+        uint32_t sample; // slot in sample_radiance
+        bool lights_sampled;
+    };
+
+    struct shadow_ray
+    {
+        ray r;
+        real t_max;
+        color radiance; // added to the sample if nothing blocks r
+        uint32_t sample;
+    };
+
+    static constexpr int num_types = static_cast<int>(material_type::custom) + 1;
+
+    size_t batch_size;
+    std::vector<path> paths;
+    std::vector<path> next_paths;
+    std::vector<hit_record> records;
+    std::vector<uint32_t> hits;
+    std::vector<uint32_t> sorted;
+    std::vector<shadow_ray> shadows;
+    std::vector<sample_key> pending;
+    std::vector<color> sample_radiance;
+
+    void trace_batch(const frame_context &frame, const tile &t, size_t first, size_t last);
+
+    template <typename M>
+    void shade(const frame_context &frame, size_t begin, size_t end, int depth)
+    {
+        for (auto k = begin; k < end; k++)
+        {
+            auto index = sorted[k];
+            auto &p = paths[index];
+            const auto &rec = records[index];
+
+            thread_samples() = p.samples;
+            bool lights_sampled = false;
+            if constexpr (std::is_same<M, lambertian>::value)
+            {
+                lights_sampled = frame.lights != nullptr;
+                ray shadow;
+                real t_max;
+                color radiance;
+                if (lights_sampled)
+                {
+                    thread_samples().start_light(depth);
+                    if (frame.lights->sample(rec, shadow, t_max, radiance))
+                    {
+                        shadows.push_back({shadow, t_max, p.throughput * rec.mat_ptr->as<M>().get_albedo() * radiance,
+                                           p.sample});
+                    }
+                }
+            }
+            thread_samples().start_bounce(depth);
+            color attenuation;
+            ray scattered;
+            // The group holds only materials of type M, so this call is direct
+            if (rec.mat_ptr->as<M>().scatter(p.r, rec, attenuation, scattered))
+            {
+                RT_STAT(scatter_events[static_cast<int>(rec.mat_ptr->type())]++);
+                color throughput = p.throughput * attenuation;
+                if (russian_roulette(throughput, depth + 1, frame.roulette_depth))
+                {
+                    next_paths.push_back({scattered, throughput, thread_samples(), p.sample, lights_sampled});
+                }
+            }
+            else
+            {
+                RT_STAT(absorbed++);
+                RT_STAT(end_path(depth));
+            }
+        }
+    }
+};
+
+void wavefront_integrator::render_tile(const frame_context &frame, const tile &t,
+                                       std::vector<pixel_accumulator> &pixels)
+{
+
+    // Each round queues the samples every unfinished pixel needs before its next check.
+    while (true)
+    {
+        pending.clear();
+        for (uint32_t pixel = 0; pixel < pixels.size(); pixel++)
+        {
+            auto target = next_sample_target(frame, pixels[pixel]);
+            for (auto s = pixels[pixel].count; s < target; s++)
+            {
+                pending.push_back({pixel, s});
+            }
+        }
+        if (pending.empty())
+        {
+            break;
+        }
+
+        sample_radiance.assign(pending.size(), color(0, 0, 0));
+        for (size_t first = 0; first < pending.size(); first += batch_size)
+        {
+            trace_batch(frame, t, first, std::min(pending.size(), first + batch_size));
+        }
+
+        // Fold in queue order, which is sample order within each pixel.
+        for (size_t k = 0; k < pending.size(); k++)
+        {
+            pixels[pending[k].pixel].add(sample_radiance[k]);
+        }
+    }
+}
+
+RT_HOT void wavefront_integrator::trace_batch(const frame_context &frame, const tile &t, size_t first, size_t last)
+{
+    paths.clear();
+    for (auto k = first; k < last; k++)
+    {
+        auto i = t.y0 + static_cast<int>(pending[k].pixel) / t.width();
+        auto j = t.x0 + static_cast<int>(pending[k].pixel) % t.width();
+        auto r = camera_ray(frame, i, j, pending[k].index);
+        paths.push_back({r, color(1, 1, 1), thread_samples(), static_cast<uint32_t>(k), false});
+    }
+
+    for (int depth = 0; depth < frame.max_depth && !paths.empty(); depth++)
+    {
+        // Intersect the whole stream, hits pick up what they emit and misses the sky right away.
+        records.resize(paths.size());
+        hits.clear();
+        size_t offsets[num_types + 1] = {};
+        RT_STAT(rays_traced += paths.size());
+        for (uint32_t k = 0; k < paths.size(); k++)
+        {
+            const auto &p = paths[k];
+            if (frame.world.hit(p.r, 0, infinity, records[k]))
+            {
+                hits.push_back(k);
+                offsets[static_cast<int>(records[k].mat_ptr->type()) + 1]++;
+                sample_radiance[p.sample] += p.throughput * hit_emission(records[k], p.lights_sampled);
+            }
+            else
+            {
+                RT_STAT(end_path(depth));
+                sample_radiance[p.sample] += p.throughput * background(frame, p.r);
+            }
+        }
+
+        // Counting sort of the hits by material type.
+        for (int m = 0; m < num_types; m++)
+        {
+            offsets[m + 1] += offsets[m];
+        }
+        sorted.resize(hits.size());
+        size_t cursor[num_types];
+        std::copy(offsets, offsets + num_types, cursor);
+        for (auto k : hits)
+        {
+            sorted[cursor[static_cast<int>(records[k].mat_ptr->type())]++] = k;
+        }
+
+        // Shade each group with its own kernel, survivors are compacted into next_paths.
+        next_paths.clear();
+        shadows.clear();
+        shade<lambertian>(frame, offsets[0], offsets[1], depth);
+        shade<metal>(frame, offsets[1], offsets[2], depth);
+        shade<dielectric>(frame, offsets[2], offsets[3], depth);
+        shade<diffuse_light>(frame, offsets[3], offsets[4], depth);
+        shade<custom_material_handle>(frame, offsets[4], offsets[5], depth);
+        paths.swap(next_paths);
+
+        // Any-hit queries for the light samples, unblocked ones add their light.
+        RT_STAT(shadow_rays += shadows.size());
+        for (const auto &shadow : shadows)
+        {
+            if (!frame.world.occluded(shadow.r, 0, shadow.t_max))
+            {
+                sample_radiance[shadow.sample] += shadow.radiance;
+            }
+        }
+    }
+
+    // Paths still alive after max_depth bounces gather no light.
+    RT_STAT(max_depth_terminations += paths.size());
+    RT_STAT(path_lengths[frame.max_depth] += paths.size());
+}
+
+#endif
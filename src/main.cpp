@@ -1,131 +1,206 @@
 #include "common.hpp"
+#include "animation.hpp"
 #include "camera.hpp"
-#include "utils/color.hpp"
+#include "utils/framebuffer.hpp"
+#include "utils/image_io.hpp"
 #include "utils/hittable.hpp"
+#include "utils/bvh.hpp"
+#include "utils/affinity.hpp"
+#include "utils/thread_pool.hpp"
+#include "utils/tile.hpp"
+#include "utils/progress.hpp"
+#include "utils/frame_writer.hpp"
+#include "utils/tile_writer.hpp"
+#include "integrator.hpp"
+#include "checkpoint.hpp"
+#include "denoise.hpp"
+#include "distributed.hpp"
+#include "options.hpp"
+#include "scene.hpp"
+#include "scene_cache.hpp"
 #include "utils/sphere.hpp"
 #include "utils/material.hpp"
 
-#include <iostream>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <csignal>
 #include <fstream>
-#include <thread>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
 #include <vector>
 
-color ray_color(const ray &r, const hittable &world, int depth)
+// Set by SIGINT and SIGTERM when checkpointing: tiles not yet started are skipped
+// and the state is saved, so that a preempted render can be resumed.
+static std::atomic<bool> stop_requested{false};
+
+extern "C" void request_stop(int)
 {
-    // If we've exceeded the ray bounce limit, no more light is gathered.
-    if (depth <= 0)
+    stop_requested = true;
+}
+
+// @brief Continue the tile-local accumulators of t with the integrator selected in opts.
+static void render_tile(const render_options &opts, const frame_context &frame, const tile &t,
+                        wavefront_integrator &wavefront, std::vector<pixel_accumulator> &pixels)
+{
+    if (opts.integrator == integrator_type::wavefront)
     {
-        return {0, 0, 0};
+        wavefront.render_tile(frame, t, pixels);
     }
-
-    hit_record rec;
-    if (world.hit(r, 0.001, infinity, rec))
+    else if (opts.integrator == integrator_type::packet)
     {
-        ray scattered;
-        color attenuation;
-        if (rec.mat_ptr->scatter(r, rec, attenuation, scattered))
-        {
-            return attenuation * ray_color(scattered, world, depth - 1);
-        }
-        return {0, 0, 0};
+        render_tile_packet(frame, t, opts.packet_size, pixels);
+    }
+    else
+    {
+        render_tile_recursive(frame, t, pixels);
     }
-    vec3 unit_direction = r.direction().unit_vector();
-    auto t = 0.5 * (unit_direction.y() + 1.0);
-    return (1.0 - t) * color(1.0, 1.0, 1.0) + t * color(0.5, 0.7, 1.0);
 }
 
-hittable_list random_scene()
+// @brief The image of the accumulated samples, or of denoised when it is not empty.
+static framebuffer resolve_image(const std::vector<pixel_accumulator> &accumulators, int image_width,
+                                 int image_height, const std::vector<color> &denoised)
 {
-    hittable_list world;
-
-    auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
-    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground_material));
-
-    for (int a = -11; a < 11; a++)
+    framebuffer image(image_width, image_height);
+    for (int i = 0; i < image_height; i++)
     {
-        for (int b = -11; b < 11; b++)
+        for (int j = 0; j < image_width; j++)
         {
-            auto choose_mat = random_double();
-            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
-
-            if ((center - point3(4, 0.2, 0)).length() > 0.9)
+            const auto &acc = accumulators[i * image_width + j];
+            if (denoised.empty())
             {
-                shared_ptr<material> sphere_material;
-
-                if (choose_mat < 0.8)
-                {
-                    // diffuse
-                    auto albedo = color::random() * color::random();
-                    sphere_material = make_shared<lambertian>(albedo);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-                else if (choose_mat < 0.95)
-                {
-                    // metal
-                    auto albedo = color::random(0.5, 1);
-                    auto fuzz = random_double(0, 0.5);
-                    sphere_material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-                else
-                {
-                    // glass
-                    sphere_material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
+                image.add(j, image_height - 1 - i, acc.sum, acc.count);
+            }
+            else
+            {
+                image.add(j, image_height - 1 - i, denoised[i * image_width + j], 1);
             }
         }
     }
-
-    auto material1 = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
-
-    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
-
-    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
-
-    return world;
-}
-
-hittable_list single_scene()
-{
-    hittable_list world;
-    // Color
-    auto color_yellow = color(0.8, 0.8, 0.0);
-    auto color_pink = color(0.7, 0.3, 0.3);
-    auto color_blue = color(0.1, 0.2, 0.5);
-    auto color_gray = color(0.8, 0.8, 0.8);
-    auto color_gloden = color(0.8, 0.6, 0.2);
-    auto color_66ccff = color(0.4, 0.8, 1);
-
-    auto material_ground = make_shared<lambertian>(color_yellow);
-    auto material_center = make_shared<lambertian>(color_blue);
-    auto material_left = make_shared<dielectric>(1.5);
-    auto material_right = make_shared<metal>(color_gloden, 1.0);
-
-    world.add(make_shared<sphere>(point3(0.0, -100.5, -1.0), 100.0, material_ground));
-    world.add(make_shared<sphere>(point3(0.0, 0.0, -1.0), 0.5, material_center));
-    world.add(make_shared<sphere>(point3(-1.0, 0.0, -1.0), 0.5, material_left));
-    world.add(make_shared<sphere>(point3(-1.0, 0.0, -1.0), -0.499, material_left));
-    world.add(make_shared<sphere>(point3(1.0, 0.0, -1.0), 0.5, material_right));
-
-    return world;
+    return image;
 }
 
 int main(int argc, char *argv[])
 {
+    if (!simd::cpu_supported())
+    {
+        std::cerr << "This CPU lacks the instruction set the renderer was built for.\n";
+        return 1;
+    }
+
+    render_options opts;
+    if (!parse_options(argc, argv, opts))
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (!opts.stats_file.empty() && !render_stats_enabled)
+    {
+        std::cerr << "--stats needs a build configured with -DRT_STATS=ON\n";
+        return 1;
+    }
+
     // Image
     const auto aspect_ratio = 16.0 / 9.0;
-    const int image_width = 720;
+    const int image_width = opts.image_width;
     const int image_height = static_cast<int>(image_width / aspect_ratio);
-    const int samples_per_pixel = 100;
-    const int max_depth = 50;
+    if (image_height < 2)
+    {
+        // The camera maps rows over image_height - 1
+        std::cerr << "--width=" << image_width << " gives fewer than 2 rows, use at least 4\n";
+        return 1;
+    }
+    const int samples_per_pixel = opts.samples_per_pixel;
+    const int max_depth = opts.max_depth;
+
+    // Interleaving spreads the pages of the scene built below over the NUMA nodes
+    const auto topology = opts.pin ? detect_topology() : cpu_topology{};
+    const bool multi_node = topology.nodes.size() > 1;
+    if (opts.numa == numa_policy::interleave && multi_node && !interleave_memory(topology))
+    {
+        std::cerr << "Failed to interleave memory, the scene stays on one node\n";
+    }
+
+    // World, mapped from the scene cache when there is one
+    scene world_scene;
+    shared_ptr<hittable> world;
+    const std::string scene_name = opts.grid > 0      ? grid_scene_name(opts.grid)
+                                   : opts.small_scene ? "small"
+                                   : opts.night       ? "night"
+                                                      : "random";
+    auto build_sphere_set = [&]()
+    {
+        if (opts.grid > 0)
+        {
+            return grid_scene(opts.grid);
+        }
+        world_scene = opts.small_scene ? single_scene() : random_scene(opts.night);
+        return make_sphere_set(world_scene);
+    };
+    if (!opts.scene_cache.empty())
+    {
+        world = load_scene_cache(opts.scene_cache, scene_name);
+        if (!world)
+        {
+            auto set = build_sphere_set();
+            if (!set || !write_scene_cache(opts.scene_cache, scene_name, *set))
+            {
+                std::cerr << "Failed to write scene cache " << opts.scene_cache << "\n";
+                return 1;
+            }
+            set.reset();
+            world = load_scene_cache(opts.scene_cache, scene_name);
+            if (!world)
+            {
+                std::cerr << "Failed to map scene cache " << opts.scene_cache << "\n";
+                return 1;
+            }
+            std::cout << "Wrote scene cache " << opts.scene_cache << "\n";
+        }
+    }
+    else if (opts.grid > 0)
+    {
+        world = build_sphere_set();
+    }
+    else
+    {
+        world_scene = opts.small_scene ? single_scene() : random_scene(opts.night);
+        world = make_shared<bvh>(world_scene.objects);
+    }
+    if (opts.numa == numa_policy::interleave && multi_node)
+    {
+        interleave_memory(topology, false);
+    }
 
-    // World
-    hittable_list world = (argc > 1 && argv[1][0] == 's') ? single_scene() : random_scene();
+    // The world each NUMA node reads, replicas made by one of its threads
+    std::vector<shared_ptr<hittable>> node_worlds(std::max<size_t>(1, topology.nodes.size()), world);
+    if (opts.numa == numa_policy::replicate && multi_node)
+    {
+        for (size_t n = 0; n < node_worlds.size(); n++)
+        {
+            run_on_cpu(topology.nodes[n][0],
+                       [&]()
+                       {
+                           if (auto copy = world->replicate())
+                           {
+                               node_worlds[n] = copy;
+                           }
+                       });
+        }
+    }
+
+    const auto *set = dynamic_cast<const sphere_set *>(world.get());
+    if (set != nullptr)
+    {
+        std::cout << "Scene " << scene_name << ": " << set->size() << " spheres, " << set->node_count()
+                  << " BVH nodes, " << set->memory_bytes() / (1024.0 * 1024.0) << " MiB\n";
+    }
+
+    // Lights for next-event estimation
+    light_list lights = set ? find_lights(*set) : find_lights(world_scene.objects);
+    const real sky_brightness = opts.night ? night_sky_brightness : 1;
 
     // Camera
     point3 lookfrom{0, 1, 10};
@@ -135,75 +210,517 @@ int main(int argc, char *argv[])
     auto aperture = 0.1;
     camera cam(lookfrom, lookat, vup, 20, aspect_ratio, aperture, dist_to_focus);
 
-    // Output and profile setting
-    auto num_thr = 1;
-    auto num_remaining = image_height;
-    auto ***out = new unsigned int **[image_height];
-    for (int i = 0; i < image_width; i++)
+    // Animation: the camera follows its path and spheres of the BVH world move
+    // from where the scene put them, the BVH refit rather than rebuilt each frame.
+    const bool animated = opts.frames > 0 || !opts.animation_file.empty();
+    const bool refittable = dynamic_cast<bvh *>(world.get()) != nullptr;
+    animation anim;
+    std::vector<std::pair<sphere *, point3>> moving; // per track, with its rest center
+    std::vector<std::vector<sphere *>> moving_copies; // per track, the sphere in each node's replica
+    if (animated)
     {
-        out[i] = new unsigned int *[image_width];
-        for (int j = 0; j < image_width; j++)
+        if (!opts.checkpoint_file.empty() || opts.workers > 0 || opts.progressive || opts.time_limit > 0 ||
+            !refittable)
+        {
+            std::cerr << "--frames and --animation cannot be combined with --checkpoint, --resume, --workers,\n"
+                      << "--progressive, --time-limit, --grid or --scene-cache\n";
+            return 1;
+        }
+        if (opts.animation_file.empty())
+        {
+            anim = orbit_animation(opts.frames, world_scene.objects, lookfrom, lookat);
+        }
+        else if (!load_animation(opts.animation_file, anim))
+        {
+            std::cerr << "Failed to read animation " << opts.animation_file << "\n";
+            return 1;
+        }
+        anim.frames = opts.frames > 0 ? opts.frames : anim.frames;
+
+        const auto &objects = world_scene.objects.get_objects();
+        for (const auto &track : anim.tracks)
+        {
+            auto *s = track.object < objects.size() ? dynamic_cast<sphere *>(objects[track.object].get()) : nullptr;
+            if (s == nullptr)
+            {
+                std::cerr << "Animation " << opts.animation_file << " moves object " << track.object
+                          << ", the scene has " << objects.size() << " spheres\n";
+                return 1;
+            }
+            moving.emplace_back(s, s->get_center());
+            moving_copies.emplace_back();
+            for (const auto &node_world : node_worlds)
+            {
+                auto *copy = node_world != world
+                                 ? static_cast<bvh &>(*world).counterpart(s, static_cast<bvh &>(*node_world))
+                                 : nullptr;
+                if (copy != nullptr && copy != s)
+                {
+                    moving_copies.back().push_back(static_cast<sphere *>(copy));
+                }
+            }
+        }
+    }
+    const int frames = animated ? anim.frames : 1;
+
+    // Passes, checkpoints, snapshots, the time limit, worker processes and the
+    // denoiser come back to pixels already rendered; only they need the image
+    // kept as double accumulators. Otherwise each tile is rendered once, from no
+    // samples, and goes straight into the float output.
+    const bool revisits_image = !opts.checkpoint_file.empty() || opts.workers > 0 || opts.progressive ||
+                                opts.time_limit > 0 || opts.pass_samples < samples_per_pixel || opts.denoise;
+
+    // Streaming keeps no image at all: nothing that revisits it can go with it.
+    if (opts.stream && (revisits_image || !opts.aov_prefix.empty() || animated))
+    {
+        std::cerr << "--stream cannot be combined with --checkpoint, --resume, --workers, --progressive,\n"
+                  << "--time-limit, --pass, --denoise, --aovs, --frames or --animation\n";
+        return 1;
+    }
+
+    // Accumulated samples, continued from a checkpoint when resuming; empty
+    // when the image is not revisited
+    const int32_t scene_id = opts.night ? 2 : opts.small_scene ? 1 : 0;
+    const checkpoint_info info{image_width, image_height, scene_id, opts.grid, max_depth, opts.roulette_depth,
+                               static_cast<int32_t>(opts.sampler)};
+    std::vector<pixel_accumulator> accumulators(revisits_image ? static_cast<size_t>(image_width) * image_height : 0);
+    if (!opts.resume_file.empty())
+    {
+        checkpoint_info saved;
+        if (!read_checkpoint(opts.resume_file, saved, accumulators))
+        {
+            std::cerr << "Failed to read checkpoint " << opts.resume_file << "\n";
+            return 1;
+        }
+        if (saved != info)
         {
-            out[i][j] = new unsigned int[3];
+            std::cerr << "Checkpoint " << opts.resume_file
+                      << " was rendered with a different image size, scene, --depth, --roulette or --sampler\n";
+            return 1;
         }
     }
+    if (!opts.checkpoint_file.empty())
+    {
+        std::signal(SIGINT, request_stop);
+        std::signal(SIGTERM, request_stop);
+    }
 
     auto start = std::chrono::system_clock::now();
 
-    // Multi thread render
-    std::vector<std::shared_ptr<std::thread>> threads;
-    for (int t = 0; t < num_thr; t++)
+    // Streamed rows of tiles are released from memory as they complete, which
+    // along the Morton curve would only begin halfway through the image.
+    const auto tiles =
+        make_tiles(image_width, image_height, opts.tile_size, opts.stream ? tile_order::scanline : tile_order::morton);
+    const sampler pixel_sampler(opts.sampler);
+    auto make_frame = [&](int target, const hittable &node_world)
+    {
+        return frame_context{cam, node_world, image_width, image_height, target, max_depth,
+                             opts.roulette_depth, opts.min_samples, opts.adaptive_threshold,
+                             opts.sampler == sampler_type::independent ? nullptr : &pixel_sampler,
+                             lights.empty() ? nullptr : &lights, sky_brightness};
+    };
+
+    // Worker processes are forked before any thread is started
+    std::unique_ptr<tile_coordinator> coordinator;
+    if (opts.workers > 0)
+    {
+        coordinator = std::make_unique<tile_coordinator>(
+            opts.workers,
+            [&](int fd)
+            {
+                wavefront_integrator wavefront;
+                serve_tiles(fd, tiles, max_depth,
+                            [&](const tile &t, int target, std::vector<pixel_accumulator> &pixels)
+                            { render_tile(opts, make_frame(target, *world), t, wavefront, pixels); });
+            });
+        if (coordinator->size() == 0)
+        {
+            std::cerr << "Failed to start worker processes\n";
+            return 1;
+        }
+    }
+
+    // Finished frames are written from another thread while the next one renders.
+    // Started before the pool pins this thread, so the writer is not pinned with it.
+    frame_writer writer;
+    std::unique_ptr<tile_writer> stream;
+    if (opts.stream)
+    {
+        // Two tiles per thread keep the threads busy while the writer catches up
+        stream = std::make_unique<tile_writer>(opts.output, image_width, image_height, 2 * size_t(opts.threads));
+        if (!stream->is_open())
+        {
+            std::cerr << "Failed to create " << opts.output << "\n";
+            return 1;
+        }
+    }
+
+    // Multi thread render, tiles are scheduled with work stealing
+    const auto placement = opts.pin ? topology.placement(opts.threads) : std::vector<std::pair<int, int>>();
+    std::vector<int> worker_cpus;
+    for (const auto &p : placement)
+    {
+        worker_cpus.push_back(p.first);
+    }
+    thread_pool pool(coordinator ? 1 : opts.threads, worker_cpus);
+    std::cout << "Rendering " << tiles.size() << " tiles";
+    if (animated)
+    {
+        std::cout << " of " << frames << " frames";
+    }
+    std::cout << " on ";
+    if (coordinator)
+    {
+        std::cout << coordinator->size() << " worker processes";
+    }
+    else
+    {
+        std::cout << pool.size() << " threads";
+        if (opts.pin)
+        {
+            std::cout << " pinned";
+            if (multi_node)
+            {
+                std::cout << " over " << topology.nodes.size() << " NUMA nodes, scene " << numa_name(opts.numa) << "d";
+            }
+        }
+    }
+    std::cout << " (" << simd::active_isa() << " " << real_name() << ", " << integrator_name(opts.integrator)
+              << ", " << sampler_name(opts.sampler) << " sampler)\n";
+
+    // Passes, each raising every pixel's sample target by pass_samples. A progressive
+    // render starts at 1 sample per pixel and doubles it up to pass_samples more per
+    // pass. Targets a resumed render already has are skipped.
+    int fewest = samples_per_pixel;
+    for (const auto &acc : accumulators)
+    {
+        fewest = std::min(fewest, acc.count);
+    }
+    std::vector<int> pass_targets;
+    for (int target = opts.progressive ? 1 : opts.pass_samples;;
+         target = opts.progressive ? std::min(2 * target, target + opts.pass_samples) : target + opts.pass_samples)
+    {
+        if (target > fewest || target >= samples_per_pixel)
+        {
+            pass_targets.push_back(std::min(target, samples_per_pixel));
+        }
+        if (target >= samples_per_pixel)
+        {
+            break;
+        }
+    }
+
+    // Tiles not yet started are skipped once interrupted or out of time
+    const auto deadline = start + std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                                      std::chrono::duration<double>(opts.time_limit));
+    auto out_of_time = [&]()
+    { return opts.time_limit > 0 && std::chrono::system_clock::now() >= deadline; };
+    auto stop_tiles = [&]()
+    { return stop_requested || out_of_time(); };
+    std::atomic<size_t> skipped_tiles{0}; // of the pass the render stopped in
+
+    // Everything a thread writes while rendering a tile is its own and starts on
+    // a cache line of its own: no line is written by two threads, and the tile
+    // buffer, first touched by its thread, sits on that thread's node. Tiles are
+    // merged into the accumulators or the output once rendered, the only shared write.
+    struct alignas(64) worker_state
+    {
+        wavefront_integrator wavefront;
+        std::vector<pixel_accumulator> pixels;
+        render_stats stats;
+        size_t node = 0; // index into node_worlds
+    };
+    std::vector<worker_state> workers(pool.size());
+    for (size_t w = 0; w < workers.size(); w++)
+    {
+        workers[w].stats = render_stats(max_depth);
+        workers[w].node = w < placement.size() ? static_cast<size_t>(placement[w].second) : 0;
+    }
+    auto last_checkpoint = std::chrono::steady_clock::now();
+    auto last_snapshot = std::chrono::steady_clock::now();
+
+    double render_seconds = 0;
+    uint64_t total_samples = 0;
+    size_t pass = 0;
+    for (int f = 0; f < frames; f++)
     {
-        auto thr = make_shared<std::thread>(
-            [&, t]()
+        auto frame_start = f == 0 ? start : std::chrono::system_clock::now();
+        if (animated)
+        {
+            point3 from, at;
+            anim.camera_at(f, from, at);
+            cam = camera(from, at, vup, 20, aspect_ratio, aperture, dist_to_focus);
+            for (size_t k = 0; k < moving.size(); k++)
+            {
+                auto center = moving[k].second + animation::offset_at(anim.tracks[k], f);
+                moving[k].first->set_center(center);
+                for (auto *copy : moving_copies[k])
+                {
+                    copy->set_center(center);
+                }
+            }
+            static_cast<bvh &>(*world).refit();
+            for (const auto &node_world : node_worlds)
             {
-                int start_height = t * (image_height / num_thr);
-                int end_height = start_height + (image_height / num_thr);
-                for (int i = start_height; i < end_height && i < image_height; i++)
+                if (node_world != world)
                 {
-                    std::cout << "\rScanlines remaining: "
-                              << ((double)num_remaining--) / image_height
-                              << "% " << std::flush;
-                    for (int j = 0; j < image_width; ++j)
+                    static_cast<bvh &>(*node_world).refit();
+                }
+            }
+            lights = find_lights(world_scene.objects);
+            std::fill(accumulators.begin(), accumulators.end(), pixel_accumulator());
+            std::cout << (f > 0 ? "\n" : "");
+        }
+
+        // Tiles rendered once are resolved into the output as they finish
+        std::unique_ptr<framebuffer> image;
+        if (accumulators.empty() && !stream)
+        {
+            image = std::make_unique<framebuffer>(image_width, image_height);
+        }
+
+        const auto label = animated ? "Frame " + std::to_string(f + 1) + "/" + std::to_string(frames) + " tiles"
+                                    : std::string("Tiles");
+        // The pool pinned this thread, the reporter is let off its CPU
+        progress_reporter progress(tiles.size() * pass_targets.size(), label.c_str(), topology.cpus());
+        for (pass = 0; pass < pass_targets.size() && !stop_tiles(); pass++)
+        {
+            if (coordinator)
+            {
+                size_t skipped = 0;
+                bool alive = coordinator->render_pass(tiles, image_width, pass_targets[pass], accumulators,
+                                                      workers[0].stats, progress, stop_tiles, skipped);
+                skipped_tiles += skipped;
+                if (!alive)
+                {
+                    progress.finish();
+                    std::cerr << "\nAll worker processes died\n";
+                    return 1;
+                }
+            }
+            else
+            {
+                std::vector<frame_context> frames_by_node;
+                for (const auto &node_world : node_worlds)
+                {
+                    frames_by_node.push_back(make_frame(pass_targets[pass], *node_world));
+                }
+                pool.parallel_for(
+                    tiles.size(),
+                    [&](size_t index, unsigned worker)
                     {
-                        color pixel_color(0, 0, 0);
-                        for (int s = 0; s < samples_per_pixel; ++s)
+                        const auto &t = tiles[index];
+                        if (stop_tiles())
+                        {
+                            // Skipped tiles keep their state, the checkpoint stays consistent.
+                            skipped_tiles++;
+                            progress.advance();
+                            return;
+                        }
+                        auto &state = workers[worker];
+                        auto &pixels = state.pixels;
+                        auto &stats = state.stats;
+                        render_stats::current() = &stats;
+                        auto tile_start = std::chrono::steady_clock::now();
+
+                        if (accumulators.empty())
+                        {
+                            pixels.assign(t.pixel_count(), pixel_accumulator());
+                            render_tile(opts, frames_by_node[state.node], t, state.wavefront, pixels);
+
+                            // A streamed tile gets a buffer of its own, tiles cover disjoint pixels of the image
+                            std::unique_ptr<framebuffer> resolved;
+                            if (stream)
+                            {
+                                resolved = std::make_unique<framebuffer>(t.width(), t.height());
+                            }
+                            auto &target = stream ? *resolved : *image;
+                            const int x0 = stream ? t.x0 : 0, top = stream ? t.y1 : image_height;
+                            for (int i = t.y0; i < t.y1; i++)
+                            {
+                                for (int j = t.x0; j < t.x1; ++j)
+                                {
+                                    const auto &rendered = pixels[(i - t.y0) * t.width() + (j - t.x0)];
+                                    stats.samples += rendered.count;
+                                    target.add(j - x0, top - 1 - i, rendered.sum, rendered.count);
+                                }
+                            }
+                            if (stream)
+                            {
+                                stream->submit(t, std::move(*resolved));
+                            }
+                        }
+                        else
                         {
-                            auto u = (j + random_double()) / (image_width - 1);
-                            auto v = (i + random_double()) / (image_height - 1);
-                            ray r = cam.get_ray(u, v);
-                            pixel_color += ray_color(r, world, max_depth);
+                            pixels.resize(t.pixel_count());
+                            for (int i = t.y0; i < t.y1; i++)
+                            {
+                                for (int j = t.x0; j < t.x1; ++j)
+                                {
+                                    pixels[(i - t.y0) * t.width() + (j - t.x0)] = accumulators[i * image_width + j];
+                                }
+                            }
+
+                            render_tile(opts, frames_by_node[state.node], t, state.wavefront, pixels);
+
+                            for (int i = t.y0; i < t.y1; i++)
+                            {
+                                for (int j = t.x0; j < t.x1; ++j)
+                                {
+                                    auto &acc = accumulators[i * image_width + j];
+                                    const auto &rendered = pixels[(i - t.y0) * t.width() + (j - t.x0)];
+                                    stats.samples += rendered.count - acc.count;
+                                    acc = rendered;
+                                }
+                            }
                         }
-                        write_color(out[i][j], pixel_color, samples_per_pixel);
+
+                        auto seconds =
+                            std::chrono::duration<double>(std::chrono::steady_clock::now() - tile_start).count();
+                        stats.tiles.push_back({t.x0, t.y0, t.x1, t.y1, seconds});
+                        render_stats::current() = nullptr;
+                        progress.advance();
+                    },
+                    // Streamed rows of tiles are dropped from the mapping once complete, so render them in turn
+                    stream != nullptr);
+            }
+
+            bool last_pass = pass + 1 == pass_targets.size();
+            auto since_checkpoint =
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - last_checkpoint).count();
+            if (!opts.checkpoint_file.empty() &&
+                (last_pass || stop_tiles() || since_checkpoint >= opts.checkpoint_interval))
+            {
+                if (!write_checkpoint(opts.checkpoint_file, info, accumulators))
+                {
+                    std::cerr << "\nFailed to write checkpoint " << opts.checkpoint_file << "\n";
+                }
+                last_checkpoint = std::chrono::steady_clock::now();
+            }
+
+            // Snapshots replace the output file whole, a viewer never sees half an image
+            auto since_snapshot =
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - last_snapshot).count();
+            if (opts.progressive && !last_pass && !stop_tiles() &&
+                (pass == 0 || since_snapshot >= opts.snapshot_interval))
+            {
+                if (!write_image(opts.output, resolve_image(accumulators, image_width, image_height, {})))
+                {
+                    std::cerr << "\nFailed to write snapshot " << opts.output << "\n";
+                }
+                last_snapshot = std::chrono::steady_clock::now();
+            }
+        }
+        progress.finish();
+        render_seconds += std::chrono::duration<double>(std::chrono::system_clock::now() - frame_start).count();
+        if (stop_requested)
+        {
+            std::cout << "\nInterrupted, resume with --resume=" << opts.checkpoint_file << "\n";
+            return 1;
+        }
+        for (const auto &acc : accumulators)
+        {
+            total_samples += acc.count;
+        }
+
+        // Feature buffers and denoising, after the render so that they never reach a checkpoint
+        aov_buffers aovs;
+        std::vector<color> denoised;
+        if (opts.denoise || !opts.aov_prefix.empty())
+        {
+            auto denoise_start = std::chrono::steady_clock::now();
+            render_aovs(make_frame(samples_per_pixel, *world), pool, aovs);
+            if (opts.denoise)
+            {
+                denoised = denoise(accumulators, aovs, image_width, image_height, pool);
+                auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - denoise_start).count();
+                std::cout << "\nDenoised in " << seconds << "s";
+            }
+        }
+        if (!opts.aov_prefix.empty())
+        {
+            const std::pair<const char *, std::function<color(size_t)>> buffers[] = {
+                {".normal.pfm", [&](size_t k) { return aovs.normal[k]; }},
+                {".albedo.pfm", [&](size_t k) { return aovs.albedo[k]; }},
+                {".depth.pfm", [&](size_t k) { return color(aovs.depth[k], aovs.depth[k], aovs.depth[k]); }},
+            };
+            for (const auto &buffer : buffers)
+            {
+                framebuffer aov(image_width, image_height);
+                for (int i = 0; i < image_height; i++)
+                {
+                    for (int j = 0; j < image_width; j++)
+                    {
+                        aov.add(j, image_height - 1 - i, buffer.second(static_cast<size_t>(i) * image_width + j), 1);
                     }
                 }
-            });
-        threads.push_back(thr);
+                auto path = (animated ? frame_path(opts.aov_prefix, f) : opts.aov_prefix) + buffer.first;
+                if (!write_pfm(path, aov))
+                {
+                    std::cerr << "\nFailed to write " << path << "\n";
+                    return 1;
+                }
+            }
+        }
+
+        // Output to file, where streamed tiles already are
+        if (!stream)
+        {
+            writer.submit(animated ? frame_path(opts.output, f) : opts.output,
+                          image ? std::move(*image) : resolve_image(accumulators, image_width, image_height, denoised));
+        }
     }
 
-    for (auto thr : threads)
+    // A pass the deadline cut short counts as not done, its skipped tiles have fewer samples
+    if (pass < pass_targets.size() || skipped_tiles > 0)
     {
-        thr->join();
+        std::cout << "\nTime limit reached after " << pass - (skipped_tiles > 0 ? 1 : 0) << " of "
+                  << pass_targets.size() << " passes";
+        if (skipped_tiles > 0)
+        {
+            std::cout << ", " << skipped_tiles << " of " << tiles.size() << " tiles of the next one skipped";
+        }
     }
 
-    // Output to file
-    std::ofstream file;
-    file.open("image.ppm", std::ios::out);
-    file << "P3\n"
-         << image_width << " " << image_height << "\n255\n";
-    for (int i = image_height - 1; i >= 0; i--)
+    render_stats totals(max_depth);
+    for (const auto &state : workers)
     {
-        for (int j = 0; j < image_width; j++)
+        totals.merge(state.stats);
+    }
+    if (accumulators.empty())
+    {
+        total_samples = totals.samples; // every pixel of every frame was rendered from none
+    }
+    std::cout << "\nAverage samples per pixel: "
+              << static_cast<double>(total_samples) / (static_cast<double>(image_width) * image_height * frames);
+
+    if (!opts.stats_file.empty())
+    {
+        std::ofstream report(opts.stats_file);
+        totals.write_json(report, render_seconds);
+        if (!report)
         {
-            file << out[i][j][0] << " "
-                 << out[i][j][1] << " "
-                 << out[i][j][2] << "\n";
-            delete[] out[i][j];
+            std::cerr << "\nFailed to write " << opts.stats_file << "\n";
+            return 1;
         }
     }
-    file.close();
+
+    if (!writer.finish())
+    {
+        return 1;
+    }
+    if (stream && !stream->finish())
+    {
+        std::cerr << "\nFailed to write " << opts.output << "\n";
+        return 1;
+    }
 
     auto end = std::chrono::system_clock::now();
-    std::cout << "\nDone. time cost: " << ((std::chrono::duration<double>)(end - start)).count() << "s\n";
+    auto seconds = ((std::chrono::duration<double>)(end - start)).count();
+    if (animated)
+    {
+        std::cout << "\nRendered " << frames << " frames, " << frames * 3600.0 / seconds << " frames per hour";
+    }
+    std::cout << "\nDone. time cost: " << seconds << "s\n";
     return 0;
-}
\ No newline at end of file
+}
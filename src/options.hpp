@@ -0,0 +1,382 @@
+#pragma once
+#ifndef OPTIONS_HPP
+#define OPTIONS_HPP
+
+#include "utils/sampler.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <thread>
+
+enum class integrator_type
+{
+    recursive,
+    wavefront,
+    packet
+};
+
+inline const char *integrator_name(integrator_type type)
+{
+    switch (type)
+    {
+    case integrator_type::wavefront:
+        return "wavefront";
+    case integrator_type::packet:
+        return "packet";
+    default:
+        return "recursive";
+    }
+}
+
+// @brief What the render threads of each NUMA node read the scene from.
+enum class numa_policy
+{
+    share,      // the one copy, wherever it was allocated
+    replicate,  // a copy per node, made by a thread of that node
+    interleave  // the one copy, its pages spread over the nodes
+};
+
+inline const char *numa_name(numa_policy policy)
+{
+    switch (policy)
+    {
+    case numa_policy::replicate:
+        return "replicate";
+    case numa_policy::interleave:
+        return "interleave";
+    default:
+        return "share";
+    }
+}
+
+/**
+ * @brief Command line settings of the renderer.
+ *
+ * Usage: ray-tracing [s] [--key=value ...]
+ * The positional "s" selects the small scene, as before.
+ */
+struct render_options
+{
+    bool small_scene = false;
+    bool night = false; // the random scene lit by some of its spheres
+    int grid = 0; // n x n spheres of the grid scene, 0 for the usual scenes
+    int image_width = 720;
+    int samples_per_pixel = 100;
+    int max_depth = 50;
+    int roulette_depth = 3; // bounces before Russian roulette may end a path
+    unsigned threads = std::thread::hardware_concurrency();
+    unsigned workers = 0; // worker processes, 0 renders in this process
+    bool pin = false;     // pin each render thread to a CPU
+    numa_policy numa = numa_policy::share;
+    int tile_size = 16;
+    integrator_type integrator = integrator_type::recursive;
+    int packet_size = 16; // camera rays per packet of the packet integrator
+    sampler_type sampler = sampler_type::sobol;
+    double adaptive_threshold = 0; // 0 disables adaptive sampling
+    int min_samples = 16;
+    std::string output = "image.ppm";
+    bool stream = false; // write tiles into the mapped output as they finish
+    bool denoise = false;
+    std::string aov_prefix; // PREFIX.normal.pfm, PREFIX.albedo.pfm, PREFIX.depth.pfm
+    std::string stats_file;
+    std::string scene_cache; // mapped scene and BVH, written on first use
+    std::string checkpoint_file;     // written between passes, empty to disable
+    std::string resume_file;         // checkpoint to continue from
+    double checkpoint_interval = 60; // seconds between checkpoints
+    int pass_samples = 0;            // samples per pass, 0 for all at once (8 when checkpointing)
+    bool progressive = false;        // 1 spp first, then refine, writing snapshots
+    double snapshot_interval = 2;    // seconds between snapshots of a progressive render
+    double time_limit = 0;           // seconds of rendering, 0 for no limit
+    int frames = 0;                  // frames of the built-in orbit animation, 0 for a still
+    std::string animation_file;      // camera path and object moves, see load_animation()
+};
+
+inline void print_usage(const char *program)
+{
+    std::cerr << "Usage: " << program << " [s] [options]\n"
+              << "  s                 render the small scene\n"
+              << "  --night           render the random scene at night, lit by glowing spheres\n"
+              << "  --grid=N          random scene with N x N small spheres, stored as a sphere set\n"
+              << "                    (e.g. 3200 for 10M spheres)\n"
+              << "  --width=N         image width in pixels, at least 4 (720)\n"
+              << "  --spp=N           samples per pixel (100)\n"
+              << "  --depth=N         maximum ray bounces, at most 16382 (50)\n"
+              << "  --roulette=N      bounces before Russian roulette may end a path (3);\n"
+              << "                    N >= --depth turns it off\n"
+              << "  --threads=N       worker threads (hardware concurrency)\n"
+              << "  --pin             pin each render thread to its own CPU, spread over the NUMA nodes\n"
+              << "  --numa=X          share, replicate or interleave (share): give each NUMA node\n"
+              << "                    its own copy of the scene, or spread its pages over the\n"
+              << "                    nodes; implies --pin\n"
+              << "  --workers=N       render tiles in N worker processes, one tile at a time\n"
+              << "                    each; tiles of a worker that dies are rendered again\n"
+              << "  --tile=N          tile edge in pixels (16)\n"
+              << "  --integrator=X    recursive, wavefront or packet (recursive)\n"
+              << "  --packet=N        camera rays per packet: 4, 8 or 16 (16)\n"
+              << "  --sampler=X       independent, sobol or blue-noise (sobol)\n"
+              << "  --adaptive=E      stop sampling a pixel once its error is below E\n"
+              << "                    (e.g. 0.005); --spp is then the per-pixel maximum\n"
+              << "  --min-spp=N       samples before the first adaptive check (16)\n"
+              << "  --output=FILE     binary PPM, or linear PFM if FILE ends in .pfm (image.ppm)\n"
+              << "  --stream          write each tile into the output file as soon as it is done,\n"
+              << "                    never holding the whole image (e.g. --width=65536 --tile=64)\n"
+              << "  --denoise         filter the image guided by first-hit normal, albedo and depth;\n"
+              << "                    clean frames from 8-16 spp\n"
+              << "  --aovs=PREFIX     write those buffers to PREFIX.normal.pfm, PREFIX.albedo.pfm\n"
+              << "                    and PREFIX.depth.pfm\n"
+              << "  --stats=FILE      write render statistics as JSON (builds with RT_STATS only)\n"
+              << "  --scene-cache=FILE  map the scene and its BVH from FILE, building and\n"
+              << "                    writing FILE first if it is missing or stale\n"
+              << "  --checkpoint=FILE save the accumulated samples to FILE between passes,\n"
+              << "                    and when interrupted by SIGINT or SIGTERM\n"
+              << "  --checkpoint-every=S  seconds between checkpoints (60)\n"
+              << "  --resume=FILE     continue from a checkpoint, up to --spp samples per pixel;\n"
+              << "                    keeps checkpointing to FILE unless --checkpoint is given\n"
+              << "  --pass=N          samples per pixel per pass (8 when checkpointing, progressive\n"
+              << "                    or time-limited)\n"
+              << "  --progressive     render 1 sample per pixel first, then refine, replacing the\n"
+              << "                    output with a snapshot after the first pass and periodically\n"
+              << "  --snapshot-every=S  seconds between progressive snapshots (2)\n"
+              << "  --time-limit=S    stop starting tiles after S seconds and write what there is;\n"
+              << "                    --spp still caps the samples\n"
+              << "  --frames=N        render N frames of the camera orbiting the scene while the\n"
+              << "                    spheres bounce, numbered into the output name; with\n"
+              << "                    --animation, overrides its frame count\n"
+              << "  --animation=FILE  render the camera path and sphere moves keyframed in FILE\n";
+}
+
+// @brief Parse a positive integer, rejecting trailing garbage and values T cannot hold.
+template <typename T>
+inline bool parse_positive(const std::string &value, T &out)
+{
+    char *end = nullptr;
+    errno = 0;
+    auto number = std::strtol(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0' || errno == ERANGE || number <= 0 ||
+        static_cast<unsigned long>(number) > static_cast<unsigned long>(std::numeric_limits<T>::max()))
+    {
+        return false;
+    }
+    out = static_cast<T>(number);
+    return true;
+}
+
+// @brief Parse a positive real number, rejecting trailing garbage.
+inline bool parse_positive(const std::string &value, double &out)
+{
+    char *end = nullptr;
+    auto number = std::strtod(value.c_str(), &end);
+    if (value.empty() || *end != '\0' || !(number > 0))
+    {
+        return false;
+    }
+    out = number;
+    return true;
+}
+
+/**
+ * @brief Parse argv into opts.
+ * @return false on an unknown option or a malformed value
+ */
+inline bool parse_options(int argc, char *argv[], render_options &opts)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "s")
+        {
+            opts.small_scene = true;
+            continue;
+        }
+        if (arg.rfind("--", 0) != 0)
+        {
+            return false;
+        }
+
+        auto eq = arg.find('=');
+        auto key = arg.substr(2, eq == std::string::npos ? std::string::npos : eq - 2);
+        auto value = eq == std::string::npos ? std::string() : arg.substr(eq + 1);
+
+        bool ok;
+        if (key == "night")
+        {
+            ok = eq == std::string::npos;
+            opts.night = true;
+        }
+        else if (key == "grid")
+        {
+            ok = parse_positive(value, opts.grid);
+        }
+        else if (key == "width")
+        {
+            ok = parse_positive(value, opts.image_width);
+        }
+        else if (key == "spp")
+        {
+            ok = parse_positive(value, opts.samples_per_pixel);
+        }
+        else if (key == "depth")
+        {
+            ok = parse_positive(value, opts.max_depth) && opts.max_depth <= max_bounce_depth;
+        }
+        else if (key == "roulette")
+        {
+            ok = parse_positive(value, opts.roulette_depth);
+        }
+        else if (key == "threads")
+        {
+            ok = parse_positive(value, opts.threads);
+        }
+        else if (key == "workers")
+        {
+            ok = parse_positive(value, opts.workers);
+        }
+        else if (key == "pin")
+        {
+            ok = eq == std::string::npos;
+            opts.pin = true;
+        }
+        else if (key == "numa")
+        {
+            ok = value == "share" || value == "replicate" || value == "interleave";
+            opts.numa = value == "replicate"    ? numa_policy::replicate
+                        : value == "interleave" ? numa_policy::interleave
+                                                : numa_policy::share;
+            opts.pin = true;
+        }
+        else if (key == "tile")
+        {
+            ok = parse_positive(value, opts.tile_size);
+        }
+        else if (key == "integrator")
+        {
+            ok = value == "recursive" || value == "wavefront" || value == "packet";
+            opts.integrator = value == "wavefront" ? integrator_type::wavefront
+                              : value == "packet"  ? integrator_type::packet
+                                                   : integrator_type::recursive;
+        }
+        else if (key == "packet")
+        {
+            ok = parse_positive(value, opts.packet_size) &&
+                 (opts.packet_size == 4 || opts.packet_size == 8 || opts.packet_size == 16);
+        }
+        else if (key == "sampler")
+        {
+            ok = value == "independent" || value == "sobol" || value == "blue-noise";
+            opts.sampler = value == "independent" ? sampler_type::independent
+                           : value == "sobol"     ? sampler_type::sobol
+                                                  : sampler_type::blue_noise;
+        }
+        else if (key == "adaptive")
+        {
+            ok = parse_positive(value, opts.adaptive_threshold);
+        }
+        else if (key == "min-spp")
+        {
+            ok = parse_positive(value, opts.min_samples);
+        }
+        else if (key == "output")
+        {
+            ok = !value.empty();
+            opts.output = value;
+        }
+        else if (key == "stream")
+        {
+            ok = eq == std::string::npos;
+            opts.stream = true;
+        }
+        else if (key == "denoise")
+        {
+            ok = eq == std::string::npos;
+            opts.denoise = true;
+        }
+        else if (key == "aovs")
+        {
+            ok = !value.empty();
+            opts.aov_prefix = value;
+        }
+        else if (key == "stats")
+        {
+            ok = !value.empty();
+            opts.stats_file = value;
+        }
+        else if (key == "scene-cache")
+        {
+            ok = !value.empty();
+            opts.scene_cache = value;
+        }
+        else if (key == "checkpoint")
+        {
+            ok = !value.empty();
+            opts.checkpoint_file = value;
+        }
+        else if (key == "checkpoint-every")
+        {
+            ok = parse_positive(value, opts.checkpoint_interval);
+        }
+        else if (key == "resume")
+        {
+            ok = !value.empty();
+            opts.resume_file = value;
+        }
+        else if (key == "pass")
+        {
+            ok = parse_positive(value, opts.pass_samples);
+        }
+        else if (key == "progressive")
+        {
+            ok = eq == std::string::npos;
+            opts.progressive = true;
+        }
+        else if (key == "snapshot-every")
+        {
+            ok = parse_positive(value, opts.snapshot_interval);
+        }
+        else if (key == "time-limit")
+        {
+            ok = parse_positive(value, opts.time_limit);
+        }
+        else if (key == "frames")
+        {
+            ok = parse_positive(value, opts.frames);
+        }
+        else if (key == "animation")
+        {
+            ok = !value.empty();
+            opts.animation_file = value;
+        }
+        else
+        {
+            ok = false;
+        }
+
+        if (!ok)
+        {
+            return false;
+        }
+    }
+
+    if (opts.night && (opts.small_scene || opts.grid > 0))
+    {
+        return false;
+    }
+    if (opts.pin && opts.workers > 0)
+    {
+        return false;
+    }
+    if (opts.checkpoint_file.empty())
+    {
+        opts.checkpoint_file = opts.resume_file;
+    }
+    if (opts.pass_samples == 0)
+    {
+        opts.pass_samples =
+            opts.checkpoint_file.empty() && !opts.progressive && opts.time_limit == 0 ? opts.samples_per_pixel : 8;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,240 @@
+#pragma once
+#ifndef SCENE_HPP
+#define SCENE_HPP
+
+#include "common.hpp"
+#include "utils/light.hpp"
+#include "utils/sphere.hpp"
+#include "utils/sphere_set.hpp"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Objects of a world together with the materials they reference.
+ */
+struct scene
+{
+    material_list materials;
+    hittable_list objects;
+};
+
+// Sky of the night scene, against the sky of the others.
+constexpr real night_sky_brightness = 0.02;
+
+/**
+ * @brief The book's final scene. At night, one in eight of the small
+ * diffuse spheres glows in its colour instead, under a dim sky; the spheres
+ * stay where they are by day.
+ */
+scene random_scene(bool night = false)
+{
+    scene world;
+
+    auto ground_material = world.materials.add(lambertian(color(0.5, 0.5, 0.5)));
+    world.objects.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground_material));
+
+    for (int a = -11; a < 11; a++)
+    {
+        for (int b = -11; b < 11; b++)
+        {
+            auto choose_mat = random_double();
+            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
+
+            if ((center - point3(4, 0.2, 0)).length() > 0.9)
+            {
+                const material *sphere_material;
+
+                if (choose_mat < 0.8)
+                {
+                    // diffuse
+                    auto albedo = color::random() * color::random();
+                    if (night && choose_mat < 0.1)
+                    {
+                        sphere_material = world.materials.add(diffuse_light(20 * albedo + color(6, 6, 6)));
+                    }
+                    else
+                    {
+                        sphere_material = world.materials.add(lambertian(albedo));
+                    }
+                    world.objects.add(make_shared<sphere>(center, 0.2, sphere_material));
+                }
+                else if (choose_mat < 0.95)
+                {
+                    // metal
+                    auto albedo = color::random(0.5, 1);
+                    auto fuzz = random_double(0, 0.5);
+                    sphere_material = world.materials.add(metal(albedo, fuzz));
+                    world.objects.add(make_shared<sphere>(center, 0.2, sphere_material));
+                }
+                else
+                {
+                    // glass
+                    sphere_material = world.materials.add(dielectric(1.5));
+                    world.objects.add(make_shared<sphere>(center, 0.2, sphere_material));
+                }
+            }
+        }
+    }
+
+    auto material1 = world.materials.add(dielectric(1.5));
+    world.objects.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+
+    auto material2 = world.materials.add(lambertian(color(0.4, 0.2, 0.1)));
+    world.objects.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+
+    auto material3 = world.materials.add(metal(color(0.7, 0.6, 0.5), 0.0));
+    world.objects.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+
+    return world;
+}
+
+scene single_scene()
+{
+    scene world;
+    // Color
+    auto color_yellow = color(0.8, 0.8, 0.0);
+    auto color_pink = color(0.7, 0.3, 0.3);
+    auto color_blue = color(0.1, 0.2, 0.5);
+    auto color_gray = color(0.8, 0.8, 0.8);
+    auto color_gloden = color(0.8, 0.6, 0.2);
+    auto color_66ccff = color(0.4, 0.8, 1);
+
+    auto material_ground = world.materials.add(lambertian(color_yellow));
+    auto material_center = world.materials.add(lambertian(color_blue));
+    auto material_left = world.materials.add(dielectric(1.5));
+    auto material_right = world.materials.add(metal(color_gloden, 1.0));
+
+    world.objects.add(make_shared<sphere>(point3(0.0, -100.5, -1.0), 100.0, material_ground));
+    world.objects.add(make_shared<sphere>(point3(0.0, 0.0, -1.0), 0.5, material_center));
+    world.objects.add(make_shared<sphere>(point3(-1.0, 0.0, -1.0), 0.5, material_left));
+    world.objects.add(make_shared<sphere>(point3(-1.0, 0.0, -1.0), -0.499, material_left));
+    world.objects.add(make_shared<sphere>(point3(1.0, 0.0, -1.0), 0.5, material_right));
+
+    return world;
+}
+
+/**
+ * @brief The spheres of world as a sphere_set, null if it holds other objects.
+ * The set keeps the scene's materials alive.
+ */
+shared_ptr<sphere_set> make_sphere_set(const scene &world)
+{
+    sphere_set_builder builder;
+    builder.keep(world.materials);
+    builder.reserve(world.objects.get_objects().size());
+    for (const auto &object : world.objects.get_objects())
+    {
+        auto *s = dynamic_cast<const sphere *>(object.get());
+        if (s == nullptr)
+        {
+            return nullptr;
+        }
+        builder.add(s->get_center(), s->get_radius(), builder.material_index(s->get_material()));
+    }
+    return builder.build();
+}
+
+// @brief The spheres of objects that are lights, for next-event estimation.
+light_list find_lights(const hittable_list &objects)
+{
+    light_list lights;
+    for (const auto &object : objects.get_objects())
+    {
+        auto *s = dynamic_cast<const sphere *>(object.get());
+        if (s != nullptr && s->get_material()->type() == material_type::diffuse_light)
+        {
+            lights.add(s->get_center(), s->get_radius(), s->get_material()->as<diffuse_light>().get_emit());
+        }
+    }
+    return lights;
+}
+
+/**
+ * @brief The spheres of set that are lights, in the order they were added to it.
+ * That is the scene's order, as find_lights() of its objects lists them, so
+ * that a light sample picks the same light whichever the scene is stored in.
+ */
+light_list find_lights(const sphere_set &set)
+{
+    const auto &data = set.get_arrays();
+    std::vector<uint32_t> found;
+    for (uint32_t i = 0; i < data.count; i++)
+    {
+        if (set.get_materials()[data.material[i]]->type() == material_type::diffuse_light)
+        {
+            found.push_back(i);
+        }
+    }
+    std::sort(found.begin(), found.end(), [&](uint32_t a, uint32_t b)
+              { return data.original[a] < data.original[b]; });
+
+    light_list lights;
+    for (auto i : found)
+    {
+        lights.add(point3(data.center[0][i], data.center[1][i], data.center[2][i]), data.radius[i],
+                   set.get_materials()[data.material[i]]->as<diffuse_light>().get_emit());
+    }
+    return lights;
+}
+
+// @brief Name of the grid scene of n x n cells, e.g. for its scene cache.
+inline std::string grid_scene_name(int n)
+{
+    return "grid-" + std::to_string(n);
+}
+
+/**
+ * @brief random_scene() with n x n small spheres instead of 22 x 22, built
+ * straight into a sphere_set. The small spheres share a palette of materials
+ * drawn with random_scene's odds, so memory stays per sphere, not per material.
+ */
+shared_ptr<sphere_set> grid_scene(int n)
+{
+    constexpr int palette_size = 256;
+    sphere_set_builder builder;
+    builder.reserve(static_cast<size_t>(n) * n + 4);
+
+    auto ground_material = builder.add_material(lambertian(color(0.5, 0.5, 0.5)));
+    builder.add(point3(0, -1000, 0), 1000, ground_material);
+
+    uint32_t palette[palette_size];
+    for (auto &entry : palette)
+    {
+        auto choose_mat = random_double();
+        if (choose_mat < 0.8)
+        {
+            entry = builder.add_material(lambertian(color::random() * color::random()));
+        }
+        else if (choose_mat < 0.95)
+        {
+            entry = builder.add_material(metal(color::random(0.5, 1), random_double(0, 0.5)));
+        }
+        else
+        {
+            entry = builder.add_material(dielectric(1.5));
+        }
+    }
+
+    for (int a = -n / 2; a < n - n / 2; a++)
+    {
+        for (int b = -n / 2; b < n - n / 2; b++)
+        {
+            auto entry = static_cast<int>(random_double() * palette_size);
+            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
+            if ((center - point3(4, 0.2, 0)).length() > 0.9)
+            {
+                builder.add(center, 0.2, palette[std::min(entry, palette_size - 1)]);
+            }
+        }
+    }
+
+    builder.add(point3(0, 1, 0), 1.0, builder.add_material(dielectric(1.5)));
+    builder.add(point3(-4, 1, 0), 1.0, builder.add_material(lambertian(color(0.4, 0.2, 0.1))));
+    builder.add(point3(4, 1, 0), 1.0, builder.add_material(metal(color(0.7, 0.6, 0.5), 0.0)));
+
+    return builder.build();
+}
+
+#endif
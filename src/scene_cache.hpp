@@ -0,0 +1,286 @@
+#pragma once
+#ifndef SCENE_CACHE_HPP
+#define SCENE_CACHE_HPP
+
+#include "common.hpp"
+#include "utils/bvh.hpp"
+#include "utils/mapped_file.hpp"
+#include "utils/material.hpp"
+#include "utils/sphere_set.hpp"
+#include "utils/temp_file.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Layout of a scene cache: a header, then 64-byte aligned sections at the
+ * offsets it gives. Nodes and sphere arrays are stored exactly as sphere_set
+ * reads them, in host byte order and the build's precision, so a mapped file
+ * is traversed in place. Caches of another precision or layout are rejected.
+ */
+namespace scene_cache_format
+{
+    constexpr char magic[8] = {'R', 'T', 'S', 'C', 'N', '0', '0', '2'};
+    constexpr uint64_t alignment = 64;
+
+    struct header
+    {
+        char magic[8];
+        char scene[16]; // name of the scene the cache was built from
+        uint32_t real_size;
+        uint32_t node_size;
+        uint32_t sphere_count;
+        uint32_t node_count;
+        uint32_t material_count;
+        uint32_t padding;
+        uint64_t nodes;         // bvh_flat_node[node_count]
+        uint64_t centers;       // real[3][sphere_count], x, y then z
+        uint64_t radii;         // real[sphere_count]
+        uint64_t materials;     // uint32_t[sphere_count], index of a sphere's material
+        uint64_t originals;     // uint32_t[sphere_count], index a sphere was added with
+        uint64_t material_data; // material_record[material_count]
+        uint64_t size;          // of the whole file
+    };
+
+    // One of the built-in materials; parameter is the fuzz of metals, the index of refraction of dielectrics.
+    // The albedo of a light is its emitted radiance.
+    struct material_record
+    {
+        uint32_t type;
+        uint32_t padding;
+        double albedo[3];
+        double parameter;
+    };
+
+    inline uint64_t align(uint64_t offset)
+    {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+} // namespace scene_cache_format
+
+/**
+ * @brief Write set, its BVH, spheres and materials, to path.
+ * The file is written under a unique name next to path and renamed over it,
+ * so readers never see a partial cache, nor one mixed from renderers that
+ * found it missing at the same time.
+ * @return false if set uses custom materials, or on I/O errors
+ */
+inline bool write_scene_cache(const std::string &path, const std::string &name, const sphere_set &set)
+{
+    namespace format = scene_cache_format;
+
+    std::vector<format::material_record> material_records;
+    for (const auto *m : set.get_materials())
+    {
+        format::material_record record{static_cast<uint32_t>(m->type()), 0, {0, 0, 0}, 0};
+        color albedo;
+        switch (m->type())
+        {
+        case material_type::lambertian:
+            albedo = m->as<lambertian>().get_albedo();
+            break;
+        case material_type::metal:
+            albedo = m->as<metal>().get_albedo();
+            record.parameter = m->as<metal>().get_fuzz();
+            break;
+        case material_type::dielectric:
+            record.parameter = m->as<dielectric>().get_index_of_refraction();
+            break;
+        case material_type::diffuse_light:
+            albedo = m->as<diffuse_light>().get_emit();
+            break;
+        default:
+            return false;
+        }
+        for (int a = 0; a < 3; a++)
+        {
+            record.albedo[a] = albedo[a];
+        }
+        material_records.push_back(record);
+    }
+
+    const auto &data = set.get_arrays();
+    uint64_t spheres = data.count;
+    format::header header{};
+    std::memcpy(header.magic, format::magic, sizeof(header.magic));
+    std::strncpy(header.scene, name.c_str(), sizeof(header.scene) - 1);
+    header.real_size = sizeof(real);
+    header.node_size = sizeof(bvh_flat_node);
+    header.sphere_count = data.count;
+    header.node_count = data.node_count;
+    header.material_count = static_cast<uint32_t>(material_records.size());
+    header.nodes = format::align(sizeof(header));
+    header.centers = format::align(header.nodes + data.node_count * sizeof(bvh_flat_node));
+    header.radii = format::align(header.centers + 3 * spheres * sizeof(real));
+    header.materials = format::align(header.radii + spheres * sizeof(real));
+    header.originals = format::align(header.materials + spheres * sizeof(uint32_t));
+    header.material_data = format::align(header.originals + spheres * sizeof(uint32_t));
+    header.size = header.material_data + material_records.size() * sizeof(format::material_record);
+
+    // Sections in file order, the gaps between them are zero padding.
+    const std::pair<uint64_t, std::pair<const void *, uint64_t>> sections[] = {
+        {0, {&header, sizeof(header)}},
+        {header.nodes, {data.nodes, data.node_count * sizeof(bvh_flat_node)}},
+        {header.centers, {data.center[0], spheres * sizeof(real)}},
+        {header.centers + spheres * sizeof(real), {data.center[1], spheres * sizeof(real)}},
+        {header.centers + 2 * spheres * sizeof(real), {data.center[2], spheres * sizeof(real)}},
+        {header.radii, {data.radius, spheres * sizeof(real)}},
+        {header.materials, {data.material, spheres * sizeof(uint32_t)}},
+        {header.originals, {data.original, spheres * sizeof(uint32_t)}},
+        {header.material_data, {material_records.data(), material_records.size() * sizeof(format::material_record)}},
+    };
+
+    auto temporary = create_temporary(path);
+    if (temporary.empty())
+    {
+        return false;
+    }
+    {
+        std::ofstream file(temporary, std::ios::out | std::ios::binary | std::ios::trunc);
+        const char padding[format::alignment] = {};
+        uint64_t offset = 0;
+        for (const auto &section : sections)
+        {
+            file.write(padding, static_cast<std::streamsize>(section.first - offset));
+            file.write(static_cast<const char *>(section.second.first),
+                       static_cast<std::streamsize>(section.second.second));
+            offset = section.first + section.second.second;
+        }
+        file.flush();
+        if (!file)
+        {
+            std::remove(temporary.c_str());
+            return false;
+        }
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Map a cache written by write_scene_cache for the scene called name.
+ * Nodes and spheres are used in place; only the materials are constructed.
+ * @return null if the file is missing, of another scene, precision or layout, or malformed
+ */
+inline shared_ptr<sphere_set> load_scene_cache(const std::string &path, const std::string &name)
+{
+    namespace format = scene_cache_format;
+
+    struct storage
+    {
+        mapped_file file;
+        material_list materials;
+        explicit storage(const std::string &path) : file(path) {}
+    };
+    auto keep = std::make_shared<storage>(path);
+    const auto *bytes = keep->file.data();
+    auto size = keep->file.size();
+
+    format::header header;
+    if (bytes == nullptr || size < sizeof(header))
+    {
+        return nullptr;
+    }
+    std::memcpy(&header, bytes, sizeof(header));
+    header.scene[sizeof(header.scene) - 1] = '\0';
+    auto aligned = [](uint64_t offset)
+    { return offset % format::alignment == 0; };
+    // Section [offset, offset + length) within the file, without offset + length wrapping
+    auto within = [&](uint64_t offset, uint64_t length)
+    { return offset <= size && length <= size - offset; };
+    uint64_t spheres = header.sphere_count;
+    if (std::memcmp(header.magic, format::magic, sizeof(header.magic)) != 0 || name != header.scene ||
+        header.real_size != sizeof(real) || header.node_size != sizeof(bvh_flat_node) || header.size != size ||
+        !aligned(header.nodes) || !aligned(header.centers) || !aligned(header.radii) ||
+        !aligned(header.materials) || !aligned(header.originals) || !aligned(header.material_data) ||
+        !within(header.nodes, uint64_t(header.node_count) * sizeof(bvh_flat_node)) ||
+        !within(header.centers, 3 * spheres * sizeof(real)) || !within(header.radii, spheres * sizeof(real)) ||
+        !within(header.materials, spheres * sizeof(uint32_t)) ||
+        !within(header.originals, spheres * sizeof(uint32_t)) ||
+        !within(header.material_data, uint64_t(header.material_count) * sizeof(format::material_record)) ||
+        (header.node_count == 0) != (spheres == 0))
+    {
+        return nullptr;
+    }
+
+    sphere_set::arrays data;
+    data.nodes = reinterpret_cast<const bvh_flat_node *>(bytes + header.nodes);
+    data.node_count = header.node_count;
+    data.count = header.sphere_count;
+    for (int a = 0; a < 3; a++)
+    {
+        data.center[a] = reinterpret_cast<const real *>(bytes + header.centers) + a * spheres;
+    }
+    data.radius = reinterpret_cast<const real *>(bytes + header.radii);
+    data.material = reinterpret_cast<const uint32_t *>(bytes + header.materials);
+    data.original = reinterpret_cast<const uint32_t *>(bytes + header.originals);
+
+    // Traversal trusts the tree, so check that it stays within the arrays and
+    // that no leaf is deeper than its fixed stack. Children come after their
+    // parent, so one pass carries the depths down.
+    std::vector<uint8_t> depth(data.node_count, 0);
+    for (uint32_t k = 0; k < data.node_count; k++)
+    {
+        const auto &node = data.nodes[k];
+        bool ok = node.count > 0 ? uint64_t(node.offset) + node.count <= spheres
+                                 : node.offset > k + 1 && node.offset < data.node_count && node.axis < 3 &&
+                                       depth[k] < bvh_builder::max_depth;
+        if (!ok)
+        {
+            return nullptr;
+        }
+        if (node.count == 0)
+        {
+            uint8_t child = depth[k] + 1;
+            depth[k + 1] = std::max(depth[k + 1], child);
+            depth[node.offset] = std::max(depth[node.offset], child);
+        }
+    }
+    for (uint32_t i = 0; i < data.count; i++)
+    {
+        if (data.material[i] >= header.material_count)
+        {
+            return nullptr;
+        }
+    }
+
+    std::vector<const material *> materials;
+    for (uint32_t k = 0; k < header.material_count; k++)
+    {
+        format::material_record record;
+        std::memcpy(&record, bytes + header.material_data + k * sizeof(record), sizeof(record));
+        color albedo(record.albedo[0], record.albedo[1], record.albedo[2]);
+        switch (static_cast<material_type>(record.type))
+        {
+        case material_type::lambertian:
+            materials.push_back(keep->materials.add(lambertian(albedo)));
+            break;
+        case material_type::metal:
+            materials.push_back(keep->materials.add(metal(albedo, record.parameter)));
+            break;
+        case material_type::dielectric:
+            materials.push_back(keep->materials.add(dielectric(record.parameter)));
+            break;
+        case material_type::diffuse_light:
+            materials.push_back(keep->materials.add(diffuse_light(albedo)));
+            break;
+        default:
+            return nullptr;
+        }
+    }
+
+    return make_shared<sphere_set>(data, std::move(materials), std::move(keep));
+}
+
+#endif
@@ -0,0 +1,137 @@
+#pragma once
+#ifndef AABB_HPP
+#define AABB_HPP
+
+#include "../common.hpp"
+#include "packet.hpp"
+
+#include <utility>
+
+/**
+ * @brief Axis-aligned bounding box, empty by default.
+ */
+class aabb
+{
+public:
+    aabb() : minimum(infinity, infinity, infinity), maximum(-infinity, -infinity, -infinity) {}
+    aabb(const point3 &a, const point3 &b) : minimum(a), maximum(b) {}
+
+    point3 min() const { return minimum; }
+    point3 max() const { return maximum; }
+
+    bool empty() const
+    {
+        return minimum.x() > maximum.x() || minimum.y() > maximum.y() || minimum.z() > maximum.z();
+    }
+
+    point3 centroid() const
+    {
+        return 0.5 * (minimum + maximum);
+    }
+
+    real surface_area() const
+    {
+        if (empty())
+        {
+            return 0;
+        }
+        vec3 d = maximum - minimum;
+        return 2.0 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+    }
+
+    int longest_axis() const
+    {
+        vec3 d = maximum - minimum;
+        if (d.x() > d.y() && d.x() > d.z())
+        {
+            return 0;
+        }
+        return d.y() > d.z() ? 1 : 2;
+    }
+
+    void expand(const point3 &p)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            minimum[a] = fmin(minimum[a], p[a]);
+            maximum[a] = fmax(maximum[a], p[a]);
+        }
+    }
+
+    void expand(const aabb &box)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            minimum[a] = fmin(minimum[a], box.minimum[a]);
+            maximum[a] = fmax(maximum[a], box.maximum[a]);
+        }
+    }
+
+    /**
+     * @brief Slab test against a ray given by its origin and per-axis inverse direction.
+     * NaNs from rays lying in a slab plane compare false and leave the interval untouched.
+     */
+    inline bool hit(const point3 &origin, const vec3 &inv_dir, real t_min, real t_max) const
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            auto t0 = (minimum[a] - origin[a]) * inv_dir[a];
+            auto t1 = (maximum[a] - origin[a]) * inv_dir[a];
+            if (inv_dir[a] < 0.0)
+            {
+                std::swap(t0, t1);
+            }
+            t_min = t0 > t_min ? t0 : t_min;
+            t_max = t1 < t_max ? t1 : t_max;
+            if (t_max < t_min)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Whether any lane of the packet enters the box in (t_min, t_max[lane]).
+     */
+    inline bool hit_any(const ray_packet &p, real t_min, const real *t_max) const
+    {
+        const real lo[3] = {minimum.x(), minimum.y(), minimum.z()};
+        const real hi[3] = {maximum.x(), maximum.y(), maximum.z()};
+        real entered = 0; // of the lanes' type, so that the loop vectorizes
+        for (int k = 0; k < p.size; k++)
+        {
+            auto near = t_min;
+            auto far = t_max[k];
+            slab(lo[0], hi[0], p.origin[0][k], p.inv_direction[0][k], near, far);
+            slab(lo[1], hi[1], p.origin[1][k], p.inv_direction[1][k], near, far);
+            slab(lo[2], hi[2], p.origin[2][k], p.inv_direction[2][k], near, far);
+            entered = near <= far ? 1 : entered;
+        }
+        return entered != 0;
+    }
+
+private:
+    point3 minimum;
+    point3 maximum;
+
+    // @brief Clip [near, far] to one slab, branch-free so that packet loops vectorize.
+    static void slab(real lo, real hi, real origin, real inv_dir, real &near, real &far)
+    {
+        auto t0 = (lo - origin) * inv_dir;
+        auto t1 = (hi - origin) * inv_dir;
+        auto t_enter = t0 < t1 ? t0 : t1;
+        auto t_exit = t0 < t1 ? t1 : t0;
+        near = t_enter > near ? t_enter : near;
+        far = t_exit < far ? t_exit : far;
+    }
+};
+
+inline aabb surrounding_box(const aabb &box0, const aabb &box1)
+{
+    aabb box = box0;
+    box.expand(box1);
+    return box;
+}
+
+#endif
@@ -0,0 +1,236 @@
+#pragma once
+#ifndef AFFINITY_HPP
+#define AFFINITY_HPP
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief CPUs the process may run on, grouped by NUMA node.
+ *
+ * Read from sched_getaffinity and /sys/devices/system/node, so it follows
+ * taskset and cpusets. Where neither is available, or on a single-node
+ * machine, all CPUs form node 0.
+ */
+struct cpu_topology
+{
+    std::vector<std::vector<int>> nodes; // CPUs of each node with any allowed, never empty
+    std::vector<int> node_ids;           // kernel number of each node
+
+    // @brief All CPUs of the nodes, in node order.
+    std::vector<int> cpus() const
+    {
+        std::vector<int> result;
+        for (const auto &node : nodes)
+        {
+            result.insert(result.end(), node.begin(), node.end());
+        }
+        return result;
+    }
+
+    /**
+     * @brief One (cpu, node) per worker, spread evenly over the CPUs in node order.
+     * parallel_for deals out contiguous blocks of tiles, so neighbouring
+     * workers, and with them neighbouring image regions, share a node.
+     * Workers beyond the CPU count wrap around.
+     */
+    std::vector<std::pair<int, int>> placement(unsigned workers) const
+    {
+        std::vector<std::pair<int, int>> all;
+        for (size_t n = 0; n < nodes.size(); n++)
+        {
+            for (int cpu : nodes[n])
+            {
+                all.emplace_back(cpu, static_cast<int>(n));
+            }
+        }
+        std::vector<std::pair<int, int>> result;
+        for (unsigned w = 0; w < workers; w++)
+        {
+            result.push_back(workers <= all.size() ? all[w * all.size() / workers] : all[w % all.size()]);
+        }
+        return result;
+    }
+};
+
+// @brief CPUs in a sysfs list such as "0-3,8-11".
+inline std::vector<int> parse_cpu_list(const std::string &text)
+{
+    std::vector<int> cpus;
+    std::istringstream in(text);
+    std::string range;
+    while (std::getline(in, range, ','))
+    {
+        int first, last;
+        char dash;
+        std::istringstream r(range);
+        if (!(r >> first))
+        {
+            continue;
+        }
+        last = (r >> dash >> last) && dash == '-' ? last : first;
+        for (int cpu = first; cpu <= last; cpu++)
+        {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+inline cpu_topology detect_topology()
+{
+    std::vector<int> allowed;
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &set))
+            {
+                allowed.push_back(cpu);
+            }
+        }
+    }
+#endif
+    if (allowed.empty())
+    {
+        for (unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); cpu++)
+        {
+            allowed.push_back(static_cast<int>(cpu));
+        }
+    }
+
+    cpu_topology result;
+    std::vector<int> placed;
+    // Node numbers may have gaps, e.g. CPU-less memory nodes
+    for (int node = 0, missing = 0; missing < 64; node++)
+    {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        std::string text;
+        if (!std::getline(file, text))
+        {
+            missing++;
+            continue;
+        }
+        missing = 0;
+        std::vector<int> cpus;
+        for (int cpu : parse_cpu_list(text))
+        {
+            if (std::find(allowed.begin(), allowed.end(), cpu) != allowed.end())
+            {
+                cpus.push_back(cpu);
+                placed.push_back(cpu);
+            }
+        }
+        if (!cpus.empty())
+        {
+            result.nodes.push_back(std::move(cpus));
+            result.node_ids.push_back(node);
+        }
+    }
+    if (placed.size() != allowed.size())
+    {
+        result.nodes.assign(1, allowed); // sysfs missing or inconsistent
+        result.node_ids.assign(1, 0);
+    }
+    return result;
+}
+
+// @brief Restrict the calling thread to cpu; false where unsupported or refused.
+inline bool pin_current_thread(int cpu)
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+/**
+ * @brief Let the calling thread run on any of cpus, for threads started by a
+ * pinned one, which inherit its CPU; false where unsupported or refused.
+ */
+inline bool unpin_current_thread(const std::vector<int> &cpus)
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+    {
+        if (cpu >= 0 && cpu < CPU_SETSIZE)
+        {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return CPU_COUNT(&set) > 0 && pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpus;
+    return false;
+#endif
+}
+
+/**
+ * @brief Spread the pages the calling thread allocates from now on round-robin
+ * over the nodes of topology, or with interleave false go back to allocating
+ * on the node that first touches them. Called directly through the system
+ * call, so that there is no dependency on libnuma.
+ * @return false where unsupported or refused
+ */
+inline bool interleave_memory(const cpu_topology &topology, bool interleave = true)
+{
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+    constexpr int mpol_default = 0, mpol_interleave = 3; // from linux/mempolicy.h
+    constexpr size_t bits = 8 * sizeof(unsigned long);
+    unsigned long mask[1024 / bits] = {};
+    for (int node : topology.node_ids)
+    {
+        if (node >= 1024)
+        {
+            return false;
+        }
+        mask[node / bits] |= 1ul << (node % bits);
+    }
+    return interleave ? syscall(SYS_set_mempolicy, mpol_interleave, mask, 1024ul + 1) == 0
+                      : syscall(SYS_set_mempolicy, mpol_default, nullptr, 0ul) == 0;
+#else
+    (void)topology;
+    (void)interleave;
+    return false;
+#endif
+}
+
+/**
+ * @brief Run fn on a thread pinned to cpu and wait for it.
+ * Memory fn allocates and first writes is then placed on that CPU's node by
+ * the kernel's first-touch policy.
+ */
+template <typename F>
+void run_on_cpu(int cpu, F &&fn)
+{
+    std::thread thread([&]()
+                       {
+                           pin_current_thread(cpu);
+                           fn();
+                       });
+    thread.join();
+}
+
+#endif
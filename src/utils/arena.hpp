@@ -0,0 +1,78 @@
+#pragma once
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+/**
+ * @brief Bump allocator carving cache-line aligned arrays out of large chunks.
+ * Nothing is freed individually and no destructors run, the chunks go all at
+ * once with the arena; so it only holds trivially destructible types.
+ */
+class arena
+{
+public:
+    static constexpr size_t alignment = 64;
+
+    explicit arena(size_t chunk_size = size_t(64) << 20)
+        : chunk_size((chunk_size + alignment - 1) / alignment * alignment)
+    {
+    }
+
+    arena(const arena &) = delete;
+    arena &operator=(const arena &) = delete;
+
+    // @brief Uninitialized storage for count objects of type T.
+    template <typename T>
+    T *allocate(size_t count)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "arena never runs destructors");
+        static_assert(alignof(T) <= alignment, "arena alignment too small");
+        return static_cast<T *>(allocate_bytes(count * sizeof(T)));
+    }
+
+    // @brief Bytes handed out so far.
+    size_t used() const { return total; }
+
+private:
+    struct chunk_free
+    {
+        void operator()(unsigned char *p) const { std::free(p); }
+    };
+
+    size_t chunk_size;
+    std::vector<std::unique_ptr<unsigned char[], chunk_free>> chunks;
+    size_t offset = 0;
+    size_t capacity = 0;
+    size_t total = 0;
+
+    void *allocate_bytes(size_t bytes)
+    {
+        bytes = (bytes + alignment - 1) / alignment * alignment;
+        if (offset + bytes > capacity)
+        {
+            // Arrays larger than a chunk get one of their own.
+            auto size = std::max(chunk_size, bytes);
+            auto *memory = static_cast<unsigned char *>(std::aligned_alloc(alignment, size));
+            if (memory == nullptr)
+            {
+                throw std::bad_alloc();
+            }
+            chunks.emplace_back(memory);
+            offset = 0;
+            capacity = size;
+        }
+        auto *result = chunks.back().get() + offset;
+        offset += bytes;
+        total += bytes;
+        return result;
+    }
+};
+
+#endif
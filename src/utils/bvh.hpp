@@ -0,0 +1,617 @@
+#pragma once
+#ifndef BVH_HPP
+#define BVH_HPP
+
+#include "../common.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <future>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Input primitive of the BVH builder: its bounds and its index in the caller's storage.
+ */
+struct bvh_build_item
+{
+    aabb box;
+    point3 centroid;
+    uint32_t index;
+};
+
+/**
+ * @brief Node of a flattened BVH, stored in depth-first order.
+ * The first child of an interior node immediately follows it.
+ */
+struct bvh_flat_node
+{
+    aabb box;
+    uint32_t offset; // leaf: first item, interior: index of the second child
+    uint16_t count;  // number of items in a leaf, 0 for interior nodes
+    uint16_t axis;   // split axis, used to visit the nearer child first
+};
+
+/**
+ * @brief Binned surface area heuristic BVH builder.
+ * Nodes are appended in their final depth-first order as they are built; large
+ * subtrees are built on separate threads and spliced in afterwards.
+ */
+class bvh_builder
+{
+public:
+    /**
+     * @param traversal_cost cost of visiting a node relative to testing one item;
+     * larger values give fewer, fuller leaves
+     */
+    explicit bvh_builder(size_t max_leaf_size = 4, double traversal_cost = 0.125)
+        : max_leaf_size(std::max<size_t>(1, max_leaf_size)), traversal_cost(traversal_cost)
+    {
+        auto hw = std::max(1u, std::thread::hardware_concurrency());
+        while ((1u << max_parallel_depth) < hw)
+        {
+            max_parallel_depth++;
+        }
+        // a little oversubscription evens out unbalanced splits
+        max_parallel_depth += 2;
+    }
+
+    /**
+     * @brief Build the tree, reordering items so that every leaf references a contiguous range.
+     */
+    std::vector<bvh_flat_node> build(std::vector<bvh_build_item> &items) const
+    {
+        std::vector<bvh_flat_node> nodes;
+        if (items.empty())
+        {
+            return nodes;
+        }
+        build_recursive(items, 0, items.size(), 0, nodes);
+        nodes.shrink_to_fit();
+        return nodes;
+    }
+
+    // Deepest node the traversal stack has to handle.
+    static constexpr int max_depth = 64;
+
+private:
+    static constexpr int num_bins = 16;
+    static constexpr size_t parallel_threshold = 4096;
+    // Past this depth splits fall back to the median, which bounds the tree height.
+    static constexpr int max_sah_depth = 32;
+
+    struct bin
+    {
+        aabb box;
+        size_t count = 0;
+    };
+
+    size_t max_leaf_size;
+    double traversal_cost;
+    int max_parallel_depth = 0;
+
+    static void make_leaf(const aabb &box, size_t begin, size_t end, std::vector<bvh_flat_node> &nodes)
+    {
+        nodes.push_back({box, static_cast<uint32_t>(begin), static_cast<uint16_t>(end - begin), 0});
+    }
+
+    // @brief Append the subtree over items [begin, end) to nodes.
+    void build_recursive(std::vector<bvh_build_item> &items, size_t begin, size_t end, int depth,
+                         std::vector<bvh_flat_node> &nodes) const
+    {
+        aabb box, centroid_box;
+        for (size_t i = begin; i < end; i++)
+        {
+            box.expand(items[i].box);
+            centroid_box.expand(items[i].centroid);
+        }
+
+        auto n = end - begin;
+        if (n == 1)
+        {
+            make_leaf(box, begin, end, nodes);
+            return;
+        }
+
+        int axis = centroid_box.longest_axis();
+        auto cmin = centroid_box.min()[axis];
+        auto extent = centroid_box.max()[axis] - cmin;
+        size_t mid = begin;
+
+        if (extent > 0 && depth < max_sah_depth)
+        {
+            bin bins[num_bins];
+            auto bin_of = [&](const bvh_build_item &item)
+            {
+                auto b = static_cast<int>(num_bins * ((item.centroid[axis] - cmin) / extent));
+                return std::min(b, num_bins - 1);
+            };
+            for (size_t i = begin; i < end; i++)
+            {
+                auto &b = bins[bin_of(items[i])];
+                b.count++;
+                b.box.expand(items[i].box);
+            }
+
+            // Sweep from the right to get the cost of every right partition.
+            double right_area[num_bins - 1];
+            size_t right_count[num_bins - 1];
+            aabb acc;
+            size_t count = 0;
+            for (int i = num_bins - 1; i > 0; i--)
+            {
+                acc.expand(bins[i].box);
+                count += bins[i].count;
+                right_area[i - 1] = acc.surface_area();
+                right_count[i - 1] = count;
+            }
+
+            acc = aabb();
+            count = 0;
+            int best_split = -1;
+            auto best_cost = infinity;
+            for (int i = 0; i < num_bins - 1; i++)
+            {
+                acc.expand(bins[i].box);
+                count += bins[i].count;
+                if (count == 0 || right_count[i] == 0)
+                {
+                    continue;
+                }
+                auto cost = acc.surface_area() * count + right_area[i] * right_count[i];
+                if (cost < best_cost)
+                {
+                    best_cost = cost;
+                    best_split = i;
+                }
+            }
+
+            auto area = box.surface_area();
+            best_cost = traversal_cost + (area > 0 ? best_cost / area : n);
+            if (n <= max_leaf_size && static_cast<double>(n) <= best_cost)
+            {
+                make_leaf(box, begin, end, nodes);
+                return;
+            }
+            if (best_split >= 0)
+            {
+                auto it = std::partition(items.begin() + begin, items.begin() + end,
+                                         [&](const bvh_build_item &item)
+                                         { return bin_of(item) <= best_split; });
+                mid = it - items.begin();
+            }
+        }
+        else if (n <= max_leaf_size)
+        {
+            make_leaf(box, begin, end, nodes);
+            return;
+        }
+
+        if (mid == begin || mid == end)
+        {
+            mid = begin + n / 2;
+            std::nth_element(items.begin() + begin, items.begin() + mid, items.begin() + end,
+                             [axis](const bvh_build_item &a, const bvh_build_item &b)
+                             { return a.centroid[axis] < b.centroid[axis]; });
+        }
+
+        auto index = nodes.size();
+        nodes.push_back({box, 0, 0, static_cast<uint16_t>(axis)});
+        if (n >= parallel_threshold && depth < max_parallel_depth)
+        {
+            std::vector<bvh_flat_node> right_nodes;
+            auto right = std::async(std::launch::async, [&, mid]()
+                                    { build_recursive(items, mid, end, depth + 1, right_nodes); });
+            build_recursive(items, begin, mid, depth + 1, nodes);
+            right.get();
+
+            // Interior offsets of the right subtree are relative to its own vector.
+            auto base = static_cast<uint32_t>(nodes.size());
+            nodes[index].offset = base;
+            for (auto node : right_nodes)
+            {
+                if (node.count == 0)
+                {
+                    node.offset += base;
+                }
+                nodes.push_back(node);
+            }
+        }
+        else
+        {
+            build_recursive(items, begin, mid, depth + 1, nodes);
+            nodes[index].offset = static_cast<uint32_t>(nodes.size());
+            build_recursive(items, mid, end, depth + 1, nodes);
+        }
+    }
+};
+
+/**
+ * @brief Bounding volume hierarchy over the objects of a hittable_list.
+ * Objects without bounds are kept aside and tested linearly.
+ */
+class bvh : public hittable
+{
+public:
+    explicit bvh(const hittable_list &list, size_t max_leaf_size = 4)
+    {
+        std::vector<bvh_build_item> items;
+        const auto &source = list.get_objects();
+        items.reserve(source.size());
+        aabb box;
+        for (const auto &object : source)
+        {
+            if (object->bounding_box(box))
+            {
+                items.push_back({box, box.centroid(), static_cast<uint32_t>(items.size())});
+                objects.push_back(object);
+            }
+            else
+            {
+                unbounded.push_back(object);
+            }
+        }
+
+        nodes = bvh_builder(max_leaf_size).build(items);
+
+        // Store the objects in leaf order.
+        std::vector<shared_ptr<hittable>> ordered;
+        ordered.reserve(items.size());
+        for (const auto &item : items)
+        {
+            ordered.push_back(objects[item.index]);
+        }
+        objects.swap(ordered);
+    }
+
+    bool hit(const ray &r, real t_min, real t_max, hit_record &rec) const override;
+    void hit_packet(const ray_packet &p, real t_min, packet_hit &hits) const override;
+    bool occluded(const ray &r, real t_min, real t_max) const override;
+    bool bounding_box(aabb &output_box) const override;
+
+    // @brief Copy of the nodes and of every object that replicates, the others stay shared.
+    shared_ptr<hittable> replicate() const override
+    {
+        auto copy = make_shared<bvh>(*this);
+        for (auto *list : {&copy->objects, &copy->unbounded})
+        {
+            for (auto &object : *list)
+            {
+                if (auto replica = object->replicate())
+                {
+                    object = replica;
+                }
+            }
+        }
+        return copy;
+    }
+
+    /**
+     * @brief The object at the place of object in replica, a replicate() of
+     * this tree; null if object is not in it.
+     */
+    hittable *counterpart(const hittable *object, const bvh &replica) const
+    {
+        for (size_t i = 0; i < objects.size(); i++)
+        {
+            if (objects[i].get() == object)
+            {
+                return replica.objects[i].get();
+            }
+        }
+        for (size_t i = 0; i < unbounded.size(); i++)
+        {
+            if (unbounded[i].get() == object)
+            {
+                return replica.unbounded[i].get();
+            }
+        }
+        return nullptr;
+    }
+
+    size_t node_count() const { return nodes.size(); }
+
+    /**
+     * @brief Recompute the node bounds after objects moved, keeping the tree.
+     * Children are stored after their parent, so one backward sweep meets every
+     * child before its parent. Far cheaper than a rebuild; traversal slows down
+     * only as objects move far from where they were when the tree was built.
+     */
+    void refit()
+    {
+        aabb box;
+        for (auto k = nodes.size(); k-- > 0;)
+        {
+            auto &node = nodes[k];
+            if (node.count > 0)
+            {
+                node.box = aabb();
+                for (uint32_t i = node.offset; i < node.offset + node.count; i++)
+                {
+                    objects[i]->bounding_box(box);
+                    node.box.expand(box);
+                }
+            }
+            else
+            {
+                node.box = surrounding_box(nodes[k + 1].box, nodes[node.offset].box);
+            }
+        }
+    }
+
+private:
+    std::vector<bvh_flat_node> nodes;
+    std::vector<shared_ptr<hittable>> objects;
+    std::vector<shared_ptr<hittable>> unbounded;
+};
+
+/**
+ * @brief Closest-hit traversal of a flattened tree.
+ * leaf(first, count, closest) tests the items of a leaf and lowers closest to
+ * the nearest hit among them.
+ * @return number of nodes visited
+ */
+template <typename Leaf>
+inline uint64_t traverse_bvh(const bvh_flat_node *nodes, const ray &r, real t_min, real &closest, Leaf &&leaf)
+{
+    const auto origin = r.origin();
+    const auto direction = r.direction();
+    const vec3 inv_dir(1.0 / direction.x(), 1.0 / direction.y(), 1.0 / direction.z());
+    const bool dir_is_neg[3] = {inv_dir.x() < 0, inv_dir.y() < 0, inv_dir.z() < 0};
+
+    uint32_t stack[bvh_builder::max_depth];
+    int stack_size = 0;
+    uint32_t current = 0;
+    uint64_t visited = 0;
+
+    while (true)
+    {
+        const auto &node = nodes[current];
+        visited++;
+        if (node.box.hit(origin, inv_dir, t_min, closest))
+        {
+            if (node.count > 0)
+            {
+                leaf(node.offset, node.count, closest);
+            }
+            else
+            {
+                // Visit the child on the near side of the split first.
+                if (dir_is_neg[node.axis])
+                {
+                    stack[stack_size++] = current + 1;
+                    current = node.offset;
+                }
+                else
+                {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+        if (stack_size == 0)
+        {
+            break;
+        }
+        current = stack[--stack_size];
+    }
+    return visited;
+}
+
+/**
+ * @brief Any-hit traversal of a flattened tree for occlusion queries.
+ * leaf(first, count) returns whether any item of the leaf blocks the ray in
+ * (t_min, t_max); the walk ends at the first leaf that does, setting blocked.
+ * @return number of nodes visited
+ */
+template <typename Leaf>
+inline uint64_t traverse_bvh_any(const bvh_flat_node *nodes, const ray &r, real t_min, real t_max, bool &blocked,
+                                 Leaf &&leaf)
+{
+    const auto origin = r.origin();
+    const auto direction = r.direction();
+    const vec3 inv_dir(1.0 / direction.x(), 1.0 / direction.y(), 1.0 / direction.z());
+    const bool dir_is_neg[3] = {inv_dir.x() < 0, inv_dir.y() < 0, inv_dir.z() < 0};
+
+    uint32_t stack[bvh_builder::max_depth];
+    int stack_size = 0;
+    uint32_t current = 0;
+    uint64_t visited = 0;
+    blocked = false;
+
+    while (true)
+    {
+        const auto &node = nodes[current];
+        visited++;
+        if (node.box.hit(origin, inv_dir, t_min, t_max))
+        {
+            if (node.count > 0)
+            {
+                if (leaf(node.offset, node.count))
+                {
+                    blocked = true;
+                    break;
+                }
+            }
+            else
+            {
+                // Near child first: blockers close to the origin end the walk soonest.
+                if (dir_is_neg[node.axis])
+                {
+                    stack[stack_size++] = current + 1;
+                    current = node.offset;
+                }
+                else
+                {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+        if (stack_size == 0)
+        {
+            break;
+        }
+        current = stack[--stack_size];
+    }
+    return visited;
+}
+
+/**
+ * @brief Traverses the tree once for the whole packet, entering a node when any
+ * lane enters its box; leaf(first, count) updates hits. The near child is picked
+ * by the first lane's direction, which suits coherent packets such as camera
+ * rays of neighbouring pixels.
+ * @return number of nodes visited
+ */
+template <typename Leaf>
+inline uint64_t traverse_bvh_packet(const bvh_flat_node *nodes, const ray_packet &p, real t_min, packet_hit &hits,
+                                    Leaf &&leaf)
+{
+    const bool dir_is_neg[3] = {p.inv_direction[0][0] < 0, p.inv_direction[1][0] < 0, p.inv_direction[2][0] < 0};
+
+    uint32_t stack[bvh_builder::max_depth];
+    int stack_size = 0;
+    uint32_t current = 0;
+    uint64_t visited = 0;
+
+    while (true)
+    {
+        const auto &node = nodes[current];
+        visited++;
+        if (node.box.hit_any(p, t_min, hits.t))
+        {
+            if (node.count > 0)
+            {
+                leaf(node.offset, node.count);
+            }
+            else
+            {
+                if (dir_is_neg[node.axis])
+                {
+                    stack[stack_size++] = current + 1;
+                    current = node.offset;
+                }
+                else
+                {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+        if (stack_size == 0)
+        {
+            break;
+        }
+        current = stack[--stack_size];
+    }
+    return visited;
+}
+
+bool bvh::hit(const ray &r, real t_min, real t_max, hit_record &rec) const
+{
+    bool hit_anything = false;
+    auto closest_so_far = t_max;
+
+    for (const auto &object : unbounded)
+    {
+        if (object->hit(r, t_min, closest_so_far, rec))
+        {
+            hit_anything = true;
+            closest_so_far = rec.t;
+        }
+    }
+
+    if (nodes.empty())
+    {
+        return hit_anything;
+    }
+
+    [[maybe_unused]] auto visited = traverse_bvh(nodes.data(), r, t_min, closest_so_far,
+                                                 [&](uint32_t first, uint32_t count, real &closest)
+                                                 {
+                                                     for (uint32_t i = first; i < first + count; i++)
+                                                     {
+                                                         if (objects[i]->hit(r, t_min, closest, rec))
+                                                         {
+                                                             hit_anything = true;
+                                                             closest = rec.t;
+                                                         }
+                                                     }
+                                                 });
+
+    RT_STAT(node_tests += visited);
+    return hit_anything;
+}
+
+void bvh::hit_packet(const ray_packet &p, real t_min, packet_hit &hits) const
+{
+    for (const auto &object : unbounded)
+    {
+        object->hit_packet(p, t_min, hits);
+    }
+
+    if (nodes.empty() || p.size == 0)
+    {
+        return;
+    }
+
+    [[maybe_unused]] auto visited = traverse_bvh_packet(nodes.data(), p, t_min, hits,
+                                                        [&](uint32_t first, uint32_t count)
+                                                        {
+                                                            for (uint32_t i = first; i < first + count; i++)
+                                                            {
+                                                                objects[i]->hit_packet(p, t_min, hits);
+                                                            }
+                                                        });
+
+    RT_STAT(node_tests += visited);
+}
+
+bool bvh::occluded(const ray &r, real t_min, real t_max) const
+{
+    for (const auto &object : unbounded)
+    {
+        if (object->occluded(r, t_min, t_max))
+        {
+            return true;
+        }
+    }
+
+    if (nodes.empty())
+    {
+        return false;
+    }
+
+    bool blocked;
+    [[maybe_unused]] auto visited = traverse_bvh_any(nodes.data(), r, t_min, t_max, blocked,
+                                                     [&](uint32_t first, uint32_t count)
+                                                     {
+                                                         for (uint32_t i = first; i < first + count; i++)
+                                                         {
+                                                             if (objects[i]->occluded(r, t_min, t_max))
+                                                             {
+                                                                 return true;
+                                                             }
+                                                         }
+                                                         return false;
+                                                     });
+
+    RT_STAT(node_tests += visited);
+    return blocked;
+}
+
+bool bvh::bounding_box(aabb &output_box) const
+{
+    if (nodes.empty() || !unbounded.empty())
+    {
+        return false;
+    }
+    output_box = nodes[0].box;
+    return true;
+}
+
+#endif
@@ -3,30 +3,37 @@
 #define COLOR_HPP
 
 #include "../common.hpp"
+#include "framebuffer.hpp"
 
-#include <iostream>
+#include <algorithm>
+#include <cstdint>
 
 /**
- * @brief Write color [0, 1.0]{3} to [0, 255]{3}
- * @param pixel_out int[3] array
- * @param pixel_color color: [0, 1.0]{3}
+ * @brief Resolve n pixels of accumulated radiance to 8-bit RGB: divide by the
+ * sample weight, apply gamma 2 and map [0, 1.0] to [0, 255].
+ * A single branch-free pass that the compiler can vectorize.
+ * @param in n pixels of framebuffer::channels floats
+ * @param out n * 3 bytes
  */
-void write_color(unsigned int out[3], color pixel_color, int samples_per_pixel)
+inline void quantize_pixels(const float *in, size_t n, uint8_t *out)
 {
-    auto r = pixel_color.x();
-    auto g = pixel_color.y();
-    auto b = pixel_color.z();
-
-    // Divide the color by the number of samples.
-    auto scale = 1.0 / samples_per_pixel;
-    r = sqrt(scale * r);
-    g = sqrt(scale * g);
-    b = sqrt(scale * b);
+    for (size_t k = 0; k < n; k++)
+    {
+        const float *p = in + k * framebuffer::channels;
+        const float scale = p[3] > 0.0f ? 1.0f / p[3] : 0.0f;
+        for (int c = 0; c < 3; c++)
+        {
+            auto v = std::sqrt(scale * p[c]);
+            v = std::min(std::max(v, 0.0f), 0.999f);
+            out[k * 3 + c] = static_cast<uint8_t>(256.0f * v);
+        }
+    }
+}
 
-    // Write the translated [0,255] value of each color component.
-    out[0] = static_cast<int>(256 * clamp(r, 0.0, 0.999));
-    out[1] = static_cast<int>(256 * clamp(g, 0.0, 0.999));
-    out[2] = static_cast<int>(256 * clamp(b, 0.0, 0.999));
+// @brief quantize_pixels() over a whole framebuffer, out in its row order.
+inline void quantize(const framebuffer &fb, uint8_t *out)
+{
+    quantize_pixels(fb.data(), fb.size(), out);
 }
 
-#endif
\ No newline at end of file
+#endif
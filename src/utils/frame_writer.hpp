@@ -0,0 +1,106 @@
+#pragma once
+#ifndef FRAME_WRITER_HPP
+#define FRAME_WRITER_HPP
+
+#include "framebuffer.hpp"
+#include "image_io.hpp"
+
+#include <condition_variable>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+/**
+ * @brief Encodes and writes finished frames from its own thread.
+ * At most one frame waits behind the one being written: submit() blocks
+ * until the slot is free, so tracing the next frame overlaps writing the
+ * last one without frames piling up in memory.
+ */
+class frame_writer
+{
+public:
+    frame_writer()
+    {
+        thread = std::thread([this]()
+                             { run(); });
+    }
+
+    ~frame_writer()
+    {
+        finish();
+    }
+
+    frame_writer(const frame_writer &) = delete;
+    frame_writer &operator=(const frame_writer &) = delete;
+
+    void submit(std::string path, framebuffer image)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        slot_free.wait(lock, [this]()
+                       { return !pending; });
+        pending_path = std::move(path);
+        pending_image = std::make_unique<framebuffer>(std::move(image));
+        pending = true;
+        frame_ready.notify_one();
+    }
+
+    /**
+     * @brief Write what is still pending and stop the writer thread.
+     * @return false if any frame failed to write
+     */
+    bool finish()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        frame_ready.notify_one();
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+        return !failed;
+    }
+
+private:
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable frame_ready, slot_free;
+    bool pending = false;
+    bool stopping = false;
+    bool failed = false;
+    std::string pending_path;
+    std::unique_ptr<framebuffer> pending_image;
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;)
+        {
+            frame_ready.wait(lock, [this]()
+                             { return pending || stopping; });
+            if (!pending)
+            {
+                return;
+            }
+            auto path = std::move(pending_path);
+            auto image = std::move(pending_image);
+            pending = false;
+            slot_free.notify_one();
+
+            lock.unlock();
+            bool written = write_image(path, *image);
+            if (!written)
+            {
+                std::cerr << "\nFailed to write " << path << "\n";
+            }
+            lock.lock();
+            failed = failed || !written;
+        }
+    }
+};
+
+#endif
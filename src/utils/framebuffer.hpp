@@ -0,0 +1,68 @@
+#pragma once
+#ifndef FRAMEBUFFER_HPP
+#define FRAMEBUFFER_HPP
+
+#include "../common.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+
+/**
+ * @brief Contiguous, cache-line aligned image of linear radiance.
+ *
+ * Each pixel is four floats: the red, green and blue radiance sums and the
+ * sample weight they were accumulated with. Rows are stored top to bottom.
+ */
+class framebuffer
+{
+public:
+    static constexpr int channels = 4;
+    static constexpr size_t alignment = 64;
+
+    framebuffer(int width, int height) : w(width), h(height)
+    {
+        auto bytes = size() * channels * sizeof(float);
+        bytes = (bytes + alignment - 1) / alignment * alignment;
+        auto *p = static_cast<float *>(std::aligned_alloc(alignment, bytes));
+        if (p == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        std::memset(p, 0, bytes);
+        pixels.reset(p);
+    }
+
+    int width() const { return w; }
+    int height() const { return h; }
+    size_t size() const { return static_cast<size_t>(w) * h; }
+
+    float *data() { return pixels.get(); }
+    const float *data() const { return pixels.get(); }
+
+    float *at(int x, int y) { return pixels.get() + (static_cast<size_t>(y) * w + x) * channels; }
+    const float *at(int x, int y) const { return pixels.get() + (static_cast<size_t>(y) * w + x) * channels; }
+
+    // @brief Accumulate a radiance sum taken with the given number of samples.
+    void add(int x, int y, const color &sum, double weight)
+    {
+        auto *p = at(x, y);
+        p[0] += static_cast<float>(sum.x());
+        p[1] += static_cast<float>(sum.y());
+        p[2] += static_cast<float>(sum.z());
+        p[3] += static_cast<float>(weight);
+    }
+
+private:
+    struct free_deleter
+    {
+        void operator()(float *p) const { std::free(p); }
+    };
+
+    int w, h;
+    std::unique_ptr<float, free_deleter> pixels;
+};
+
+#endif
@@ -3,6 +3,7 @@
 #define HITTABLE_HPP
 
 #include "../common.hpp"
+#include "packet.hpp"
 
 #include <memory>
 #include <vector>
@@ -16,8 +17,9 @@ struct hit_record
 {
     point3 p;
     vec3 normal;
-    shared_ptr<material> mat_ptr;
-    double t;
+    const material *mat_ptr; // owned by the scene's material_list
+    real t;
+    real error; // bound on the distance of p from the surface, per coordinate
     bool front_face;
 
     inline void set_face_normal(const ray &r, const vec3 &outward_normal)
@@ -25,12 +27,64 @@ struct hit_record
         front_face = r.direction().dot(outward_normal) < 0;
         normal = front_face ? outward_normal : -outward_normal;
     }
+
+    // @brief Ray leaving the hit point, started on the side of the surface it heads to.
+    ray spawn_ray(const vec3 &direction) const
+    {
+        return {offset_ray_origin(p, direction.dot(normal) < 0 ? -normal : normal, error), direction};
+    }
 };
 
 class hittable
 {
 public:
-    virtual bool hit(const ray &r, double t_min, double t_max, hit_record &rec) const = 0;
+    virtual ~hittable() = default;
+
+    /**
+     * @brief Closest hit in (t_min, t_max); rec is only written when returning true.
+     * Secondary rays come from hit_record::spawn_ray, so t_min can be 0.
+     */
+    virtual bool hit(const ray &r, real t_min, real t_max, hit_record &rec) const = 0;
+
+    /**
+     * @brief Closest hits of a packet in (t_min, hits.t), lane by lane.
+     * The default traces each lane with hit() and records this as the object.
+     */
+    virtual void hit_packet(const ray_packet &p, real t_min, packet_hit &hits) const;
+
+    /**
+     * @brief Hit record of a lane that hit_packet found to hit primitive of this object.
+     * Objects that record themselves in packet_hit::object ignore primitive.
+     */
+    virtual bool hit_primitive(const ray &r, uint32_t primitive, hit_record &rec) const
+    {
+        (void)primitive;
+        return hit(r, 0, infinity, rec);
+    }
+
+    /**
+     * @brief Whether anything blocks r in (t_min, t_max), for shadow rays.
+     * Stops at the first hit found, and fills no hit record. The default
+     * searches for the closest hit; aggregates override it to exit early.
+     */
+    virtual bool occluded(const ray &r, real t_min, real t_max) const
+    {
+        hit_record rec;
+        return hit(r, t_min, t_max, rec);
+    }
+
+    /**
+     * @brief Copy of the object's read-only data for a thread on another NUMA
+     * node, allocated by the calling thread so that first touch places it on
+     * that thread's node. Null if the object is to be shared as it is.
+     */
+    virtual shared_ptr<hittable> replicate() const { return nullptr; }
+
+    /**
+     * @brief Bounds of the object, used to build acceleration structures.
+     * @return false if the object is unbounded (e.g. an infinite plane)
+     */
+    virtual bool bounding_box(aabb &output_box) const = 0;
 };
 
 class hittable_list : public hittable
@@ -42,29 +96,86 @@ public:
     void clear() { objects.clear(); }
     void add(shared_ptr<hittable> object) { objects.push_back(object); }
 
-    virtual bool hit(const ray &r, double t_min, double t_max, hit_record &rec) const override;
+    const std::vector<shared_ptr<hittable>> &get_objects() const { return objects; }
+
+    virtual bool hit(const ray &r, real t_min, real t_max, hit_record &rec) const override;
+    virtual void hit_packet(const ray_packet &p, real t_min, packet_hit &hits) const override;
+    virtual bool occluded(const ray &r, real t_min, real t_max) const override;
+    virtual bool bounding_box(aabb &output_box) const override;
 
 private:
     std::vector<shared_ptr<hittable>> objects;
 };
 
-bool hittable_list::hit(const ray &r, double t_min, double t_max, hit_record &rec) const
+void hittable::hit_packet(const ray_packet &p, real t_min, packet_hit &hits) const
+{
+    hit_record rec;
+    for (int k = 0; k < p.size; k++)
+    {
+        if (hit(p.get(k), t_min, hits.t[k], rec))
+        {
+            hits.t[k] = rec.t;
+            hits.object[k] = this;
+        }
+    }
+}
+
+bool hittable_list::hit(const ray &r, real t_min, real t_max, hit_record &rec) const
 {
-    hit_record temp_rec;
     bool hit_anything = false;
     auto closest_so_far = t_max;
 
     for (const auto &object : objects)
     {
-        if (object->hit(r, t_min, closest_so_far, temp_rec))
+        if (object->hit(r, t_min, closest_so_far, rec))
         {
             hit_anything = true;
-            closest_so_far = temp_rec.t;
-            rec = temp_rec;
+            closest_so_far = rec.t;
         }
     }
 
     return hit_anything;
 }
 
+void hittable_list::hit_packet(const ray_packet &p, real t_min, packet_hit &hits) const
+{
+    for (const auto &object : objects)
+    {
+        object->hit_packet(p, t_min, hits);
+    }
+}
+
+bool hittable_list::occluded(const ray &r, real t_min, real t_max) const
+{
+    for (const auto &object : objects)
+    {
+        if (object->occluded(r, t_min, t_max))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool hittable_list::bounding_box(aabb &output_box) const
+{
+    if (objects.empty())
+    {
+        return false;
+    }
+
+    aabb temp_box;
+    output_box = aabb();
+    for (const auto &object : objects)
+    {
+        if (!object->bounding_box(temp_box))
+        {
+            return false;
+        }
+        output_box.expand(temp_box);
+    }
+
+    return true;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,105 @@
+#pragma once
+#ifndef IMAGE_IO_HPP
+#define IMAGE_IO_HPP
+
+#include "color.hpp"
+#include "framebuffer.hpp"
+#include "temp_file.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// @brief Whether path names a PFM file rather than a PPM one.
+inline bool is_pfm_path(const std::string &path)
+{
+    return path.size() >= 4 && path.compare(path.size() - 4, 4, ".pfm") == 0;
+}
+
+// @brief Header of a binary PPM, or of a little-endian PFM, of width x height pixels.
+inline std::string image_header(bool pfm, int width, int height)
+{
+    return (pfm ? "PF\n" : "P6\n") + std::to_string(width) + " " + std::to_string(height) +
+           (pfm ? "\n-1.0\n" : "\n255\n");
+}
+
+// @brief Binary (P6) PPM from 8-bit RGB rows stored top to bottom.
+inline bool write_ppm(const std::string &path, const uint8_t *rgb, int width, int height)
+{
+    std::ofstream file(path, std::ios::out | std::ios::binary);
+    file << image_header(false, width, height);
+    file.write(reinterpret_cast<const char *>(rgb), static_cast<std::streamsize>(width) * height * 3);
+    return static_cast<bool>(file);
+}
+
+// @brief Linear radiance of n pixels of framebuffer::channels floats, 3 floats each.
+inline void resolve_pixels(const float *in, size_t n, float *out)
+{
+    for (size_t k = 0; k < n; k++)
+    {
+        const float *p = in + k * framebuffer::channels;
+        const float scale = p[3] > 0.0f ? 1.0f / p[3] : 0.0f;
+        out[k * 3 + 0] = p[0] * scale;
+        out[k * 3 + 1] = p[1] * scale;
+        out[k * 3 + 2] = p[2] * scale;
+    }
+}
+
+/**
+ * @brief Portable float map of the linear radiance.
+ * Floats are written in host order and tagged little-endian (scale -1.0).
+ * PFM stores scanlines bottom to top.
+ */
+inline bool write_pfm(const std::string &path, const framebuffer &fb)
+{
+    std::ofstream file(path, std::ios::out | std::ios::binary);
+    file << image_header(true, fb.width(), fb.height());
+
+    std::vector<float> row(static_cast<size_t>(fb.width()) * 3);
+    for (int y = fb.height() - 1; y >= 0; y--)
+    {
+        resolve_pixels(fb.at(0, y), static_cast<size_t>(fb.width()), row.data());
+        file.write(reinterpret_cast<const char *>(row.data()), static_cast<std::streamsize>(row.size() * sizeof(float)));
+    }
+    return static_cast<bool>(file);
+}
+
+/**
+ * @brief Write fb to path, as PFM when the name ends in .pfm and as binary PPM otherwise.
+ * The file is written next to path and renamed over it, so that a viewer
+ * reading path always finds a whole image, the previous one or the new one.
+ */
+inline bool write_image(const std::string &path, const framebuffer &fb)
+{
+    auto temporary = create_temporary(path);
+    if (temporary.empty())
+    {
+        return false;
+    }
+    bool written;
+    if (is_pfm_path(path))
+    {
+        written = write_pfm(temporary, fb);
+    }
+    else
+    {
+        std::vector<uint8_t> rgb(fb.size() * 3);
+        quantize(fb, rgb.data());
+        written = write_ppm(temporary, rgb.data(), fb.width(), fb.height());
+    }
+    if (!written)
+    {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,141 @@
+#pragma once
+#ifndef LIGHT_HPP
+#define LIGHT_HPP
+
+#include "../common.hpp"
+
+#include <algorithm>
+#include <vector>
+
+// @brief An emitting sphere, as next-event estimation samples it.
+struct sphere_light
+{
+    point3 center;
+    real radius;
+    color emit;
+};
+
+/**
+ * @brief The lights of a scene, for next-event estimation.
+ *
+ * A sample picks a light in proportion to how much it could send to the
+ * shaded point, its luminance times the solid angle it subtends and zero if it
+ * lies wholly behind the surface, so that the lights nearby get most of the
+ * samples. A direction is then drawn uniformly in the cone the light's sphere
+ * subtends, which only ever lands on the side of the sphere the point can see.
+ * Small and distant lights are then hit by every sample instead of by the odd
+ * scattered ray. Picking costs a pass over the lights per sample.
+ */
+class light_list
+{
+public:
+    void add(const point3 &center, real radius, const color &emit)
+    {
+        lights.push_back({center, std::fabs(radius), emit});
+        power.push_back(static_cast<real>(0.2126 * emit.x() + 0.7152 * emit.y() + 0.0722 * emit.z()));
+    }
+
+    bool empty() const { return lights.empty(); }
+    size_t size() const { return lights.size(); }
+
+    /**
+     * @brief Sample the light arriving at a diffuse surface hit at rec.
+     * Draws three numbers from the thread's sample stream.
+     * @param shadow ray towards the light, blocked if anything is hit before t_max
+     * @param radiance emitted radiance times the cosine at rec over pi and the
+     * sample's pdf; times the albedo, the lambertian estimate if unblocked
+     * @return false if the sample carries no light
+     */
+    bool sample(const hit_record &rec, ray &shadow, real &t_max, color &radiance) const
+    {
+        // The direction takes a pair of dimensions, the choice of light the next one.
+        const auto u = random_double(), v = random_double();
+        const auto pick = random_double();
+
+        // Running sums of the weights, for a binary search
+        thread_local std::vector<real> cumulative;
+        cumulative.resize(lights.size());
+        real total = 0;
+        for (size_t k = 0; k < lights.size(); k++)
+        {
+            total += weight(k, rec);
+            cumulative[k] = total;
+        }
+        if (!(total > 0))
+        {
+            return false;
+        }
+        // First light whose sum passes the target; zero weights never do
+        auto index = static_cast<size_t>(std::upper_bound(cumulative.begin(), cumulative.end(), pick * total) -
+                                         cumulative.begin());
+        index = std::min(index, lights.size() - 1);
+        while (cumulative[index] == (index > 0 ? cumulative[index - 1] : 0))
+        {
+            index--; // rounding ran past the last light that counts
+        }
+        const auto chosen = cumulative[index] - (index > 0 ? cumulative[index - 1] : 0);
+        const auto &light = lights[index];
+
+        const vec3 to_center = light.center - rec.p;
+        const auto distance_squared = to_center.length_squared();
+        const auto radius_squared = light.radius * light.radius;
+        const auto cone = solid_angle(distance_squared, radius_squared);
+        const auto cos_theta = 1 - u * cone;
+        const auto sin_theta = sqrt(fmax(static_cast<real>(0), 1 - cos_theta * cos_theta));
+        const auto phi = 2 * pi * v;
+
+        // Orthonormal basis around the axis of the cone (Duff et al. 2017)
+        const auto distance = sqrt(distance_squared);
+        const vec3 w = to_center / distance;
+        const auto sign = std::copysign(static_cast<real>(1), w.z());
+        const auto a = -1 / (sign + w.z());
+        const auto b = w.x() * w.y() * a;
+        const vec3 tangent(1 + sign * w.x() * w.x() * a, sign * b, -sign * w.x());
+        const vec3 bitangent(b, sign + w.y() * w.y() * a, -w.y());
+        const vec3 direction = (sin_theta * std::cos(phi)) * tangent + (sin_theta * std::sin(phi)) * bitangent +
+                               cos_theta * w;
+
+        const auto cosine = direction.dot(rec.normal);
+        if (cosine <= 0)
+        {
+            return false;
+        }
+        // Near side of the sphere along direction, less a margin so that the light does not shadow itself
+        const auto t = distance * cos_theta -
+                       sqrt(fmax(static_cast<real>(0), radius_squared - distance_squared * sin_theta * sin_theta));
+        shadow = rec.spawn_ray(direction);
+        t_max = t * (1 - shadow_margin);
+        // pdf = chosen / total / (2 pi cone)
+        radiance = light.emit * (2 * cone * cosine * total / chosen);
+        return true;
+    }
+
+private:
+    static constexpr real shadow_margin = 1e-3;
+
+    std::vector<sphere_light> lights;
+    std::vector<real> power; // luminance of the emitted radiance
+
+    // @brief 1 - cos of the half angle of the cone a sphere subtends, without cancellation for small cones.
+    static real solid_angle(real distance_squared, real radius_squared)
+    {
+        const auto sin_squared = radius_squared / distance_squared;
+        return sin_squared / (1 + sqrt(1 - sin_squared));
+    }
+
+    // @brief Odds of picking light k at rec, up to a common factor.
+    real weight(size_t k, const hit_record &rec) const
+    {
+        const auto &light = lights[k];
+        const vec3 to_center = light.center - rec.p;
+        const auto distance_squared = to_center.length_squared();
+        const auto radius_squared = light.radius * light.radius;
+        if (distance_squared <= radius_squared || to_center.dot(rec.normal) <= -light.radius)
+        {
+            return 0;
+        }
+        return power[k] * solid_angle(distance_squared, radius_squared);
+    }
+};
+
+#endif
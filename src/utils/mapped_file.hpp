@@ -0,0 +1,63 @@
+#pragma once
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief A whole file mapped read-only and shared.
+ * Processes mapping the same file share its physical pages through the page
+ * cache, and pages are only read from disk once touched.
+ */
+class mapped_file
+{
+public:
+    mapped_file() = default;
+
+    explicit mapped_file(const std::string &path)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return;
+        }
+        struct stat info;
+        if (::fstat(fd, &info) == 0 && info.st_size > 0)
+        {
+            auto *mapping = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+            if (mapping != MAP_FAILED)
+            {
+                bytes = static_cast<const unsigned char *>(mapping);
+                length = static_cast<size_t>(info.st_size);
+            }
+        }
+        ::close(fd);
+    }
+
+    ~mapped_file()
+    {
+        if (bytes != nullptr)
+        {
+            ::munmap(const_cast<unsigned char *>(bytes), length);
+        }
+    }
+
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+
+    // @brief Start of the mapping, null if the file could not be mapped.
+    const unsigned char *data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const unsigned char *bytes = nullptr;
+    size_t length = 0;
+};
+
+#endif
@@ -4,22 +4,54 @@
 
 #include "../common.hpp"
 
-class material
+#include <deque>
+#include <memory>
+#include <variant>
+
+// @brief Concrete type of a material, lets batched shading group hits by kernel.
+enum class material_type
+{
+    lambertian,
+    metal,
+    dielectric,
+    diffuse_light,
+    custom
+};
+
+/**
+ * @brief Extension point for materials other than the built-in ones.
+ * A material holds these behind a pointer and calls them virtually.
+ */
+class custom_material
 {
 public:
+    virtual ~custom_material() = default;
+
     virtual bool scatter(
         const ray &r_in, const hit_record &rec,
         color &attenuation, ray &scattered) const = 0;
+
+    // @brief Surface colour for the denoiser's albedo buffer.
+    virtual color albedo() const { return {1, 1, 1}; }
+
+    // @brief Radiance given off at rec; found by paths that hit it, never sampled as a light.
+    virtual color emitted(const hit_record &rec) const
+    {
+        (void)rec;
+        return {0, 0, 0};
+    }
 };
 
-class lambertian : public material
+class lambertian
 {
 public:
     explicit lambertian(const color &a) : albedo(a){};
 
+    const color &get_albedo() const { return albedo; }
+
     bool scatter(
         const ray &r_in, const hit_record &rec,
-        color &attenuation, ray &scattered) const override
+        color &attenuation, ray &scattered) const
     {
         auto scatter_direction = rec.normal + vec3::random_unit_vector();
 
@@ -27,7 +59,7 @@ public:
         if (scatter_direction.near_zero())
             scatter_direction = rec.normal;
 
-        scattered = ray(rec.p, scatter_direction);
+        scattered = rec.spawn_ray(scatter_direction);
         attenuation = albedo;
         return true;
     }
@@ -36,44 +68,48 @@ private:
     color albedo;
 };
 
-class metal : public material
+class metal
 {
 public:
-    metal(const color &a, double f) : albedo(a), fuzz(f < 1 ? f : 1){};
+    metal(const color &a, real f) : albedo(a), fuzz(f < 1 ? f : 1){};
+
+    const color &get_albedo() const { return albedo; }
+    real get_fuzz() const { return fuzz; }
 
     bool scatter(
         const ray &r_in, const hit_record &rec,
-        color &attenuation, ray &scattered) const override;
-    ;
+        color &attenuation, ray &scattered) const;
 
 private:
     color albedo;
-    double fuzz;
+    real fuzz;
 };
 
-bool metal::scatter(const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered) const
+inline bool metal::scatter(const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered) const
 {
     vec3 reflected = reflect(r_in.direction().unit_vector(), rec.normal);
-    scattered = ray(rec.p, reflected + fuzz * vec3::random_in_unit_sphere());
+    scattered = rec.spawn_ray(reflected + fuzz * vec3::random_in_unit_sphere());
     attenuation = albedo;
     return (scattered.direction().dot(rec.normal) > 0);
 }
 
-class dielectric : public material
+class dielectric
 {
 public:
-    explicit dielectric(double index_of_refraction) : ir(index_of_refraction) {}
+    explicit dielectric(real index_of_refraction) : ir(index_of_refraction) {}
+
+    real get_index_of_refraction() const { return ir; }
 
     bool scatter(
         const ray &r_in, const hit_record &rec,
-        color &attenuation, ray &scattered) const override
+        color &attenuation, ray &scattered) const
     {
         attenuation = color(1.0, 1.0, 1.0);
-        double refraction_ratio = rec.front_face ? (1.0 / ir) : ir;
+        real refraction_ratio = rec.front_face ? (1.0 / ir) : ir;
 
         vec3 unit_direction = r_in.direction().unit_vector();
-        double cos_theta = fmin((-unit_direction).dot(rec.normal), 1.0);
-        double sin_theta = sqrt(1.0 - cos_theta * cos_theta);
+        real cos_theta = fmin((-unit_direction).dot(rec.normal), 1.0);
+        real sin_theta = sqrt(1.0 - cos_theta * cos_theta);
 
         bool cannot_refract = refraction_ratio * sin_theta > 1.0;
         vec3 direction;
@@ -87,14 +123,14 @@ public:
             direction = refract(unit_direction, rec.normal, refraction_ratio);
         }
 
-        scattered = ray(rec.p, direction);
+        scattered = rec.spawn_ray(direction);
         return true;
     }
 
 private:
-    double ir; // Index of Refraction
+    real ir; // Index of Refraction
 
-    static double reflectance(double cosine, double ref_idx)
+    static real reflectance(real cosine, real ref_idx)
     {
         // Use Schlick's approximation for reflectance.
         auto r0 = (1 - ref_idx) / (1 + ref_idx);
@@ -103,4 +139,156 @@ private:
     }
 };
 
-#endif
\ No newline at end of file
+/**
+ * @brief Emitter that scatters nothing and gives off the same radiance in
+ * every direction from the front of its surface. Spheres of this material are
+ * the lights that next-event estimation samples.
+ */
+class diffuse_light
+{
+public:
+    explicit diffuse_light(const color &emit) : emit(emit) {}
+
+    const color &get_emit() const { return emit; }
+
+    bool scatter(
+        const ray &r_in, const hit_record &rec,
+        color &attenuation, ray &scattered) const
+    {
+        (void)r_in;
+        (void)rec;
+        (void)attenuation;
+        (void)scattered;
+        return false;
+    }
+
+    color emitted(const hit_record &rec) const { return rec.front_face ? emit : color(0, 0, 0); }
+
+private:
+    color emit;
+};
+
+// @brief A custom_material as one of the alternatives of material.
+class custom_material_handle
+{
+public:
+    explicit custom_material_handle(shared_ptr<const custom_material> m) : impl(std::move(m)) {}
+
+    bool scatter(
+        const ray &r_in, const hit_record &rec,
+        color &attenuation, ray &scattered) const
+    {
+        return impl->scatter(r_in, rec, attenuation, scattered);
+    }
+
+    color albedo() const { return impl->albedo(); }
+
+    color emitted(const hit_record &rec) const { return impl->emitted(rec); }
+
+private:
+    shared_ptr<const custom_material> impl;
+};
+
+/**
+ * @brief Any material: one of the built-in ones, stored inline, or a custom one.
+ *
+ * The set of alternatives is closed, so scatter() is a switch whose cases are
+ * direct calls the compiler can inline; in a scene of a single material type
+ * the switch always takes the same branch. Only custom materials pay for a
+ * virtual call.
+ */
+class material
+{
+public:
+    material(const lambertian &m) : value(m) {}
+    material(const metal &m) : value(m) {}
+    material(const dielectric &m) : value(m) {}
+    material(const diffuse_light &m) : value(m) {}
+    material(shared_ptr<const custom_material> m) : value(custom_material_handle(std::move(m))) {}
+
+    // The alternatives are in the order of material_type.
+    material_type type() const { return static_cast<material_type>(value.index()); }
+
+    // @brief The alternative of type M, which must be the one held.
+    template <typename M>
+    const M &as() const { return *std::get_if<M>(&value); }
+
+    bool scatter(
+        const ray &r_in, const hit_record &rec,
+        color &attenuation, ray &scattered) const
+    {
+        switch (type())
+        {
+        case material_type::lambertian:
+            return as<lambertian>().scatter(r_in, rec, attenuation, scattered);
+        case material_type::metal:
+            return as<metal>().scatter(r_in, rec, attenuation, scattered);
+        case material_type::dielectric:
+            return as<dielectric>().scatter(r_in, rec, attenuation, scattered);
+        case material_type::diffuse_light:
+            return false;
+        default:
+            return as<custom_material_handle>().scatter(r_in, rec, attenuation, scattered);
+        }
+    }
+
+    // @brief Surface colour, white for glass: what the denoiser's albedo buffer holds.
+    color albedo() const
+    {
+        switch (type())
+        {
+        case material_type::lambertian:
+            return as<lambertian>().get_albedo();
+        case material_type::metal:
+            return as<metal>().get_albedo();
+        case material_type::dielectric:
+            return {1, 1, 1};
+        case material_type::diffuse_light:
+            return as<diffuse_light>().get_emit();
+        default:
+            return as<custom_material_handle>().albedo();
+        }
+    }
+
+    // @brief Radiance given off at rec, black for all but emitters.
+    color emitted(const hit_record &rec) const
+    {
+        switch (type())
+        {
+        case material_type::diffuse_light:
+            return as<diffuse_light>().emitted(rec);
+        case material_type::custom:
+            return as<custom_material_handle>().emitted(rec);
+        default:
+            return {0, 0, 0};
+        }
+    }
+
+private:
+    std::variant<lambertian, metal, dielectric, diffuse_light, custom_material_handle> value;
+};
+
+/**
+ * @brief Table of the materials of a scene.
+ * Primitives and hit records refer to them through plain pointers, so the hit
+ * path never touches a reference count. Entries never move, and copies of the
+ * list share its table, so pointers stay valid as long as any copy lives.
+ */
+class material_list
+{
+public:
+    const material *add(const material &m)
+    {
+        table->push_back(m);
+        return &table->back();
+    }
+
+    const material *add(shared_ptr<custom_material> m) { return add(material(std::move(m))); }
+
+    size_t size() const { return table->size(); }
+
+private:
+    shared_ptr<std::deque<material>> table = make_shared<std::deque<material>>();
+};
+
+#endif
@@ -0,0 +1,66 @@
+#pragma once
+#ifndef PACKET_HPP
+#define PACKET_HPP
+
+#include "../common.hpp"
+
+#include <cstdint>
+
+class hittable;
+
+/**
+ * @brief Up to max_size rays in structure-of-arrays layout.
+ *
+ * Lanes [0, size) are live. Kernels loop over the lanes with branch-free
+ * bodies, which the compiler turns into masked vector arithmetic.
+ */
+struct ray_packet
+{
+    static constexpr int max_size = 16;
+
+    int size = 0;
+    alignas(64) real origin[3][max_size];
+    alignas(64) real direction[3][max_size];
+    alignas(64) real inv_direction[3][max_size];
+
+    void set(int k, const ray &r)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            origin[a][k] = r.origin()[a];
+            direction[a][k] = r.direction()[a];
+            inv_direction[a][k] = 1 / r.direction()[a];
+        }
+    }
+
+    ray get(int k) const
+    {
+        return {point3(origin[0][k], origin[1][k], origin[2][k]),
+                vec3(direction[0][k], direction[1][k], direction[2][k])};
+    }
+};
+
+/**
+ * @brief Closest hits of a packet found so far.
+ * A lane's object is null until it hits; its hit_record is then recovered with
+ * object->hit_primitive(ray, primitive). Objects that hold many primitives
+ * without being hittables themselves use primitive to tell them apart.
+ */
+struct packet_hit
+{
+    alignas(64) real t[ray_packet::max_size];
+    const hittable *object[ray_packet::max_size];
+    uint32_t primitive[ray_packet::max_size];
+
+    explicit packet_hit(real t_max = infinity)
+    {
+        for (int k = 0; k < ray_packet::max_size; k++)
+        {
+            t[k] = t_max;
+            object[k] = nullptr;
+            primitive[k] = 0;
+        }
+    }
+};
+
+#endif
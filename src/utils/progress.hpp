@@ -0,0 +1,106 @@
+#pragma once
+#ifndef PROGRESS_HPP
+#define PROGRESS_HPP
+
+#include "affinity.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Prints a progress line from its own thread at a fixed rate.
+ * Workers only bump an atomic counter, so they never contend on the console.
+ * Given cpus, the reporter thread runs on any of them rather than on the CPU
+ * of a pinned thread constructing it, where it would preempt that thread's work.
+ */
+class progress_reporter
+{
+public:
+    explicit progress_reporter(size_t total, const char *unit = "Tiles", const std::vector<int> &cpus = {},
+                               std::chrono::milliseconds interval = std::chrono::milliseconds(250))
+        : total(total), unit(unit), interval(interval), start(std::chrono::steady_clock::now())
+    {
+        thread = std::thread([this, cpus]()
+                             {
+                                 if (!cpus.empty())
+                                 {
+                                     unpin_current_thread(cpus);
+                                 }
+                                 run();
+                             });
+    }
+
+    ~progress_reporter()
+    {
+        finish();
+    }
+
+    progress_reporter(const progress_reporter &) = delete;
+    progress_reporter &operator=(const progress_reporter &) = delete;
+
+    void advance(size_t n = 1)
+    {
+        done.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    // @brief Print the final line and stop the reporter thread.
+    void finish()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+    }
+
+private:
+    size_t total;
+    const char *unit;
+    std::chrono::milliseconds interval;
+    std::chrono::steady_clock::time_point start;
+    std::atomic<size_t> done{0};
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!wake.wait_for(lock, interval, [this]()
+                              { return stopping; }))
+        {
+            print();
+        }
+        print();
+    }
+
+    void print() const
+    {
+        auto n = done.load(std::memory_order_relaxed);
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        auto fraction = total > 0 ? static_cast<double>(n) / total : 1.0;
+        std::printf("\r%s: %zu/%zu (%5.1f%%), %.1fs elapsed", unit, n, total, 100.0 * fraction, elapsed);
+        if (n > 0 && n < total)
+        {
+            std::printf(", ~%.1fs left ", elapsed / fraction - elapsed);
+        }
+        else
+        {
+            std::printf("%12s", "");
+        }
+        std::fflush(stdout);
+    }
+};
+
+#endif
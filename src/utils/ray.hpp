@@ -13,7 +13,7 @@ public:
     point3 origin() const { return orig; }
     vec3 direction() const { return dir; }
 
-    point3 at(double t) const
+    point3 at(real t) const
     {
         return orig + t * dir;
     }
@@ -23,4 +23,20 @@ private:
     vec3 dir;
 };
 
+/**
+ * @brief Move a point computed on a surface off it along n, far enough that a ray
+ * starting there cannot hit the surface again because of rounding.
+ * @param error bound on the distance of p from the surface in every coordinate,
+ * at least a few ulps of p
+ *
+ * Leaves the box of that size around p along n, as pbrt does. The offset is
+ * doubled instead of rounding the result away from the surface, which the
+ * addition can round back towards by half an ulp.
+ */
+inline point3 offset_ray_origin(const point3 &p, const vec3 &n, real error)
+{
+    auto d = 2 * error * (fabs(n.x()) + fabs(n.y()) + fabs(n.z()));
+    return p + d * n;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,30 @@
+#pragma once
+#ifndef REAL_HPP
+#define REAL_HPP
+
+/**
+ * @file real.hpp
+ * @brief Scalar type of the math core.
+ *
+ * double by default. With RT_USE_FLOAT (see the CMake option of the same name)
+ * vectors, rays, primitives, bounding boxes and the camera are single precision,
+ * which halves their footprint and doubles the lanes of a vector register.
+ */
+
+#if defined(RT_USE_FLOAT)
+typedef float real;
+#else
+typedef double real;
+#endif
+
+// @brief Name of real, for reports.
+inline const char *real_name()
+{
+#if defined(RT_USE_FLOAT)
+    return "float";
+#else
+    return "double";
+#endif
+}
+
+#endif
@@ -0,0 +1,78 @@
+#pragma once
+#ifndef RNG_HPP
+#define RNG_HPP
+
+#include <cstdint>
+
+// @brief SplitMix64 finalizer, turns structured keys into well mixed seeds.
+constexpr uint64_t mix64(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * @brief PCG32 (XSH-RR) generator, 64 bit state and a selectable stream.
+ *
+ * Renders seed one generator per pixel sample with for_sample, so every
+ * sample sees the same numbers whichever thread or tile traces it.
+ */
+class pcg32
+{
+public:
+    constexpr pcg32() = default;
+
+    constexpr pcg32(uint64_t seed, uint64_t stream) : state(0), inc((stream << 1u) | 1u)
+    {
+        next_uint();
+        state += seed;
+        next_uint();
+    }
+
+    // @brief Generator keyed by pixel index and sample index.
+    static constexpr pcg32 for_sample(uint64_t pixel, uint64_t sample)
+    {
+        return {mix64(pixel ^ mix64(sample)), pixel};
+    }
+
+    constexpr uint32_t next_uint()
+    {
+        auto old = state;
+        state = old * 6364136223846793005ULL + inc;
+        auto xorshifted = static_cast<uint32_t>(((old >> 18u) ^ old) >> 27u);
+        auto rot = static_cast<uint32_t>(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((~rot + 1u) & 31u));
+    }
+
+    // @brief Returns a random real in [0,1).
+    constexpr double next_double()
+    {
+        return to_double(next_uint());
+    }
+
+    // @brief Returns a random real in [0,1).
+    constexpr float next_float()
+    {
+        return to_float(next_uint());
+    }
+
+    // @brief The 32 bit fraction bits as a real in [0,1).
+    static constexpr double to_double(uint32_t bits)
+    {
+        return bits * (1.0 / 4294967296.0);
+    }
+
+    // @brief From the top 24 bits, so that it never rounds up to 1.
+    static constexpr float to_float(uint32_t bits)
+    {
+        return (bits >> 8) * (1.0f / 16777216.0f);
+    }
+
+private:
+    uint64_t state = 0x853c49e6748fea9bULL;
+    uint64_t inc = 0xda3e39cb94b95bdbULL;
+};
+
+#endif
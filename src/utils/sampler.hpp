@@ -0,0 +1,381 @@
+#pragma once
+#ifndef SAMPLER_HPP
+#define SAMPLER_HPP
+
+#include "real.hpp"
+#include "rng.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+enum class sampler_type
+{
+    independent,
+    sobol,
+    blue_noise
+};
+
+inline const char *sampler_name(sampler_type type)
+{
+    switch (type)
+    {
+    case sampler_type::sobol:
+        return "sobol";
+    case sampler_type::blue_noise:
+        return "blue-noise";
+    default:
+        return "independent";
+    }
+}
+
+// Dimensions of a sample: the pixel jitter and lens position first, then a
+// fixed block per bounce, so that a dimension means the same thing in every
+// sample whatever happened earlier on its path.
+constexpr uint32_t camera_dimensions = 4;
+constexpr uint32_t bounce_dimensions = 4;
+// Light sampling at a bounce has a block of its own, far past the bounce
+// blocks, so that they keep their dimensions whether a scene has lights or not.
+constexpr uint32_t light_dimensions_start = 1u << 16;
+constexpr uint32_t light_dimensions = 4;
+// Deepest bounce whose block still ends before the light blocks; --depth is capped to it.
+constexpr int max_bounce_depth = static_cast<int>((light_dimensions_start - camera_dimensions) / bounce_dimensions) - 1;
+
+inline uint32_t reverse_bits(uint32_t x)
+{
+    x = __builtin_bswap32(x);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x >> 4) & 0x0f0f0f0fu);
+    x = ((x & 0x33333333u) << 2) | ((x >> 2) & 0x33333333u);
+    return ((x & 0x55555555u) << 1) | ((x >> 1) & 0x55555555u);
+}
+
+/**
+ * @brief Laine-Karras permutation (constants from Burley 2020): bit k of the
+ * result depends only on bits 0..k of x. On a bit-reversed binary fraction
+ * this is a hashed Owen scrambling, each digit flipped depending only on the
+ * digits before it, so the stratification of a point set survives.
+ */
+inline uint32_t laine_karras(uint32_t x, uint32_t seed)
+{
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+// @brief Owen scrambling of a 32 bit binary fraction.
+inline uint32_t owen_scramble(uint32_t x, uint32_t seed)
+{
+    return reverse_bits(laine_karras(reverse_bits(x), seed));
+}
+
+/**
+ * @brief Second dimension of the Sobol sequence; the first is reverse_bits(index).
+ * Its generator matrix is applied a byte of the index at a time from tables.
+ */
+inline uint32_t sobol_second(uint32_t index)
+{
+    struct tables
+    {
+        uint32_t bytes[4][256];
+
+        constexpr tables() : bytes()
+        {
+            uint32_t columns[32] = {};
+            for (uint32_t bit = 0, v = 1u << 31; bit < 32; bit++, v ^= v >> 1)
+            {
+                columns[bit] = v;
+            }
+            for (int b = 0; b < 4; b++)
+            {
+                for (uint32_t value = 0; value < 256; value++)
+                {
+                    for (int bit = 0; bit < 8; bit++)
+                    {
+                        if (value & (1u << bit))
+                        {
+                            bytes[b][value] ^= columns[8 * b + bit];
+                        }
+                    }
+                }
+            }
+        }
+    };
+    static constexpr tables matrix;
+    return matrix.bytes[0][index & 0xff] ^ matrix.bytes[1][(index >> 8) & 0xff] ^
+           matrix.bytes[2][(index >> 16) & 0xff] ^ matrix.bytes[3][index >> 24];
+}
+
+/**
+ * @brief Where each sample takes its numbers from, by pixel, sample index and dimension.
+ *
+ * independent draws every number from the sample's own PCG stream, as before.
+ * sobol pads the first two Sobol dimensions: every pair of dimensions is a
+ * 2D Sobol sequence, Owen scrambled and index-shuffled with seeds hashed from
+ * the pixel and the pair, so pairs are independent of each other but the
+ * samples of a pixel stratify each pair at every power of two.
+ * blue_noise gives every pixel the same scrambled sequence, shifted toroidally
+ * by a 64x64 void-and-cluster blue-noise mask; neighbouring pixels then get
+ * far-apart shifts and the error left at low sample counts is spread as high
+ * frequency noise (Georgiev and Fajardo 2016).
+ */
+class sampler
+{
+public:
+    static constexpr int mask_size = 64;
+
+    explicit sampler(sampler_type type) : kind(type)
+    {
+        if (kind == sampler_type::blue_noise)
+        {
+            mask = blue_noise_mask();
+        }
+    }
+
+    sampler_type type() const { return kind; }
+
+    // @brief Per-pixel part of the scrambling seeds, computed once per sample.
+    uint64_t pixel_seed(uint32_t x, uint32_t y) const
+    {
+        return kind == sampler_type::sobol ? mix64(static_cast<uint64_t>(y) << 32 | x) : 0;
+    }
+
+    /**
+     * @brief Dimensions 2 pair and 2 pair + 1 of sample index of pixel (x, y), as
+     * 32 bit fractions; not for independent samples.
+     */
+    void sample_pair(uint32_t x, uint32_t y, uint64_t pixel, uint32_t index, uint32_t pair, uint32_t out[2]) const
+    {
+        // pixel is already hashed, one more round decorrelates the pairs
+        const auto seeds = mix64(pixel + pair * 0x9e3779b97f4a7c15ULL);
+        const auto more_seeds = seeds * 0xd1342543de82ef95ULL;
+        // Owen scrambled index: the shuffle keeps aligned power-of-two blocks of samples together.
+        const auto shuffled = owen_scramble(index, static_cast<uint32_t>(seeds));
+        // The first Sobol dimension is the bit-reversed index, whose own reversal cancels.
+        out[0] = reverse_bits(laine_karras(shuffled, static_cast<uint32_t>(seeds >> 32)));
+        out[1] = owen_scramble(sobol_second(shuffled), static_cast<uint32_t>(more_seeds));
+        if (kind == sampler_type::blue_noise)
+        {
+            // Each dimension reads the mask at its own toroidal offset.
+            for (int k = 0; k < 2; k++)
+            {
+                auto offset = static_cast<uint32_t>(more_seeds >> (32 + 12 * k));
+                out[k] += mask[((y + (offset >> 6)) % mask_size) * mask_size + (x + offset) % mask_size];
+            }
+        }
+    }
+
+private:
+    sampler_type kind;
+    std::vector<uint32_t> mask; // blue-noise shifts as 32 bit fractions
+
+    static std::vector<uint32_t> blue_noise_mask();
+};
+
+/**
+ * @brief Ranks of a void-and-cluster (Ulichney 1993) dither array, as fractions.
+ * Built once, in a few tens of milliseconds.
+ */
+inline std::vector<uint32_t> sampler::blue_noise_mask()
+{
+    constexpr int n = mask_size;
+    constexpr int cells = n * n;
+    static const std::vector<uint32_t> built = []()
+    {
+        // Toroidal Gaussian filter, sigma 1.5
+        std::vector<float> kernel(cells);
+        for (int dy = 0; dy < n; dy++)
+        {
+            for (int dx = 0; dx < n; dx++)
+            {
+                auto wx = std::min(dx, n - dx), wy = std::min(dy, n - dy);
+                kernel[dy * n + dx] = std::exp(-static_cast<float>(wx * wx + wy * wy) / (2 * 1.5f * 1.5f));
+            }
+        }
+        std::vector<char> on(cells, 0);
+        std::vector<float> energy(cells, 0);
+        auto splat = [&](int cell, float sign)
+        {
+            const int cx = cell % n, cy = cell / n;
+            for (int y = 0; y < n; y++)
+            {
+                const float *row = &kernel[((y - cy + n) % n) * n];
+                for (int x = 0; x < n; x++)
+                {
+                    energy[y * n + x] += sign * row[(x - cx + n) % n];
+                }
+            }
+        };
+        auto toggle = [&](int cell, float sign)
+        {
+            on[cell] = !on[cell];
+            splat(cell, sign);
+        };
+        // Tightest cluster among cells in state value, or the largest void when looking for free cells.
+        auto extreme = [&](char value, bool largest)
+        {
+            int best = -1;
+            for (int cell = 0; cell < cells; cell++)
+            {
+                if (on[cell] == value &&
+                    (best < 0 || (largest ? energy[cell] > energy[best] : energy[cell] < energy[best])))
+                {
+                    best = cell;
+                }
+            }
+            return best;
+        };
+
+        // Initial pattern: random tenth of the cells, relaxed until the tightest
+        // cluster is also the largest void.
+        pcg32 rng(0x5eed, 1);
+        int ones = 0;
+        while (ones < cells / 10)
+        {
+            auto cell = static_cast<int>(rng.next_uint() % cells);
+            if (!on[cell])
+            {
+                toggle(cell, 1);
+                ones++;
+            }
+        }
+        for (;;)
+        {
+            auto cluster = extreme(1, true);
+            toggle(cluster, -1);
+            auto void_cell = extreme(0, false);
+            toggle(void_cell, 1);
+            if (void_cell == cluster)
+            {
+                break;
+            }
+        }
+        const auto initial = on;
+        const auto initial_energy = energy;
+
+        std::vector<int> rank(cells);
+        // Phase 1: rank the initial points by removing the tightest cluster.
+        for (int r = ones - 1; r >= 0; r--)
+        {
+            auto cluster = extreme(1, true);
+            toggle(cluster, -1);
+            rank[cluster] = r;
+        }
+        // Phase 2: fill the largest voids up to half.
+        on = initial;
+        energy = initial_energy;
+        int r = ones;
+        for (; r < cells / 2; r++)
+        {
+            auto void_cell = extreme(0, false);
+            toggle(void_cell, 1);
+            rank[void_cell] = r;
+        }
+        // Phase 3: the free cells are now the minority; fill their tightest cluster,
+        // measured by an energy of the free cells.
+        std::fill(energy.begin(), energy.end(), 0.0f);
+        for (int cell = 0; cell < cells; cell++)
+        {
+            if (!on[cell])
+            {
+                splat(cell, 1);
+            }
+        }
+        for (; r < cells; r++)
+        {
+            auto cluster = extreme(0, true);
+            on[cluster] = 1;
+            splat(cluster, -1);
+            rank[cluster] = r;
+        }
+
+        std::vector<uint32_t> mask(cells);
+        for (int cell = 0; cell < cells; cell++)
+        {
+            mask[cell] = static_cast<uint32_t>((static_cast<uint64_t>(rank[cell]) << 32) / cells);
+        }
+        return mask;
+    }();
+    return built;
+}
+
+/**
+ * @brief Numbers of one pixel sample, what random_double() draws from.
+ *
+ * Without a sampler, or past the dimensions of the current block, the numbers
+ * come from the sample's PCG stream, keyed by pixel and sample index as before.
+ * Paths carry their stream along, so they draw the same numbers in every integrator.
+ */
+class sample_stream
+{
+public:
+    sample_stream() = default;
+
+    sample_stream(const sampler *source, uint32_t x, uint32_t y, uint64_t pixel, uint32_t index)
+        : rng(pcg32::for_sample(pixel, index)), source(source), seed(source ? source->pixel_seed(x, y) : 0), x(x),
+          y(y), index(index)
+    {
+    }
+
+    // @brief Move on to the dimensions of a bounce; bounce 0 follows the camera ray.
+    void start_bounce(int bounce)
+    {
+        dimension = camera_dimensions + static_cast<uint32_t>(bounce) * bounce_dimensions;
+        block_end = dimension + bounce_dimensions;
+    }
+
+    // @brief Move on to the dimensions of light sampling at a bounce.
+    void start_light(int bounce)
+    {
+        dimension = light_dimensions_start + static_cast<uint32_t>(bounce) * light_dimensions;
+        block_end = dimension + light_dimensions;
+    }
+
+    // @brief Returns a real in [0,1).
+    real next()
+    {
+        uint32_t bits;
+        if (source == nullptr || dimension >= block_end)
+        {
+            bits = rng.next_uint();
+        }
+        else
+        {
+            // Dimensions come in pairs, the second is kept from the first.
+            if ((dimension & 1) == 0)
+            {
+                source->sample_pair(x, y, seed, index, dimension >> 1, pair);
+            }
+            bits = pair[dimension++ & 1];
+        }
+#if defined(RT_USE_FLOAT)
+        return pcg32::to_float(bits);
+#else
+        return pcg32::to_double(bits);
+#endif
+    }
+
+    pcg32 &generator() { return rng; }
+
+private:
+    pcg32 rng;
+    const sampler *source = nullptr;
+    uint64_t seed = 0;
+    uint32_t x = 0, y = 0;
+    uint32_t index = 0;
+    uint32_t dimension = 0;
+    uint32_t block_end = camera_dimensions;
+    uint32_t pair[2] = {};
+};
+
+// @brief Stream of the calling thread, used by random_double().
+inline sample_stream &thread_samples()
+{
+    thread_local sample_stream samples;
+    return samples;
+}
+
+#endif
@@ -0,0 +1,132 @@
+#pragma once
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+/**
+ * @file simd.hpp
+ * @brief Vector kernels behind vec3 and runtime instruction set dispatch.
+ *
+ * By default vec3 is three scalars of type real, which measures fastest for this
+ * renderer's one-ray-at-a-time code. With RT_SIMD_VEC3 on GCC/Clang the kernels
+ * use generic vector extensions on 4 aligned lanes, so the same source lowers to
+ * SSE2 or AVX2 depending on the target of the function it is inlined into.
+ * Non-virtual hot functions are marked RT_HOT: on GCC for x86-64 Linux this
+ * builds an AVX2 and a baseline clone, and the loader picks one per CPU.
+ */
+
+#include <cmath>
+#include <cstring>
+
+#include "real.hpp"
+
+// Opt in with -DRT_SIMD_VEC3, see the RT_SIMD_VEC3 CMake option.
+#if defined(RT_SIMD_VEC3) && defined(__GNUC__)
+#define RT_SIMD_VECTOR_EXT 1
+#endif
+
+#if defined(RT_SIMD_VECTOR_EXT) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__) && !defined(__AVX2__)
+#define RT_HOT __attribute__((target_clones("avx2", "default")))
+#define RT_SIMD_DISPATCH 1
+#else
+#define RT_HOT
+#endif
+
+namespace simd
+{
+#if defined(RT_SIMD_VECTOR_EXT)
+    constexpr int lanes = 4;
+    typedef real packed3 __attribute__((vector_size(4 * sizeof(real))));
+
+    inline packed3 load(const real *p)
+    {
+        packed3 v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    inline void store(real *p, packed3 v)
+    {
+        std::memcpy(p, &v, sizeof(v));
+    }
+
+    inline packed3 broadcast(real t)
+    {
+        return packed3{t, t, t, 0};
+    }
+
+    // @brief Rotate the xyz lanes to yzx, w stays in place.
+    inline packed3 yzx(packed3 v)
+    {
+#if defined(__clang__)
+        return __builtin_shufflevector(v, v, 1, 2, 0, 3);
+#else
+#if defined(RT_USE_FLOAT)
+        typedef int lane_index __attribute__((vector_size(16)));
+#else
+        typedef long long lane_index __attribute__((vector_size(32)));
+#endif
+        return __builtin_shuffle(v, lane_index{1, 2, 0, 3});
+#endif
+    }
+
+    inline real hsum3(packed3 v)
+    {
+        return v[0] + v[1] + v[2];
+    }
+#else
+    constexpr int lanes = 3;
+
+    struct packed3
+    {
+        real v[3];
+
+        real operator[](int i) const { return v[i]; }
+        real &operator[](int i) { return v[i]; }
+    };
+
+    inline packed3 operator+(packed3 a, packed3 b) { return {{a[0] + b[0], a[1] + b[1], a[2] + b[2]}}; }
+    inline packed3 operator-(packed3 a, packed3 b) { return {{a[0] - b[0], a[1] - b[1], a[2] - b[2]}}; }
+    inline packed3 operator*(packed3 a, packed3 b) { return {{a[0] * b[0], a[1] * b[1], a[2] * b[2]}}; }
+    inline packed3 operator-(packed3 a) { return {{-a[0], -a[1], -a[2]}}; }
+
+    inline packed3 load(const real *p) { return {{p[0], p[1], p[2]}}; }
+    inline void store(real *p, packed3 v) { p[0] = v[0], p[1] = v[1], p[2] = v[2]; }
+    inline packed3 broadcast(real t) { return {{t, t, t}}; }
+    inline packed3 yzx(packed3 v) { return {{v[1], v[2], v[0]}}; }
+    inline real hsum3(packed3 v) { return v[0] + v[1] + v[2]; }
+#endif
+
+    /**
+     * @brief Name of the vec3 kernel variant the running CPU executes.
+     */
+    inline const char *active_isa()
+    {
+#if !defined(RT_SIMD_VECTOR_EXT)
+        return "scalar";
+#elif defined(RT_SIMD_DISPATCH)
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") ? "avx2" : "sse2";
+#elif defined(__AVX2__)
+        return "avx2";
+#elif defined(__SSE2__)
+        return "sse2";
+#else
+        return "generic";
+#endif
+    }
+
+    /**
+     * @brief Whether the running CPU has every instruction set the binary was compiled for.
+     */
+    inline bool cpu_supported()
+    {
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__AVX2__)
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#else
+        return true;
+#endif
+    }
+} // namespace simd
+
+#endif
@@ -8,49 +8,181 @@ class sphere : public hittable
 {
 public:
     sphere() = default;
-    sphere(point3 cen, double r, shared_ptr<material> m) : center(cen), radius(r), mat_ptr(m){};
+    sphere(point3 cen, real r, const material *m) : center(cen), radius(r), mat_ptr(m){};
 
-    bool hit(const ray &r, double t_min, double t_max, hit_record &rec) const override;
+    bool hit(const ray &r, real t_min, real t_max, hit_record &rec) const override;
+    void hit_packet(const ray_packet &p, real t_min, packet_hit &hits) const override;
+    bool occluded(const ray &r, real t_min, real t_max) const override;
+    bool bounding_box(aabb &output_box) const override;
+    // @brief Copy of the sphere; its material stays shared.
+    shared_ptr<hittable> replicate() const override { return make_shared<sphere>(*this); }
+
+    const point3 &get_center() const { return center; }
+    real get_radius() const { return radius; }
+    // @brief Move the sphere; a bvh over it needs a refit() afterwards.
+    void set_center(const point3 &c) { center = c; }
+    const material *get_material() const { return mat_ptr; }
 
 private:
     point3 center;
-    double radius{};
-    shared_ptr<material> mat_ptr;
+    real radius{};
+    const material *mat_ptr = nullptr;
 };
 
-bool sphere::hit(const ray &r, double t_min, double t_max, hit_record &rec) const
+/**
+ * @brief Fill rec, except for its material, for a hit of r at root on the sphere.
+ * The hit point is projected back onto the sphere, which bounds its error by
+ * the sphere's size and position whatever the error of root.
+ */
+inline void set_sphere_hit(const point3 &center, real radius, const ray &r, real root, hit_record &rec)
 {
+    vec3 outward_normal = (r.at(root) - center).unit_vector();
+    if (radius < 0)
+    {
+        outward_normal = -outward_normal;
+    }
+    rec.t = root;
+    rec.p = center + radius * outward_normal;
+    rec.error = 8 * std::numeric_limits<real>::epsilon() *
+                (fmax(fabs(center.x()), fmax(fabs(center.y()), fabs(center.z()))) + fabs(radius));
+    rec.set_face_normal(r, outward_normal);
+}
+
+/**
+ * @brief Nearest root of r with the sphere of center and radius (negative for
+ * hollow spheres) in [t_min, t_max].
+ */
+inline bool sphere_root(const point3 &center, real radius, const ray &r, real t_min, real t_max, real &root)
+{
+    RT_STAT(intersection_tests++);
 
     vec3 oc = r.origin() - center;
     auto a = r.direction().length_squared();
     auto half_b = oc.dot(r.direction());
     auto c = oc.length_squared() - radius * radius;
 
+    // Starting outside and heading away, both roots are negative.
+    if (c > 0 && half_b > 0)
+    {
+        return false;
+    }
+
     auto discriminant = half_b * half_b - a * c;
     if (discriminant < 0)
     {
         return false;
     }
-    auto sqrtd = sqrt(discriminant);
 
-    // Find the nearest root that lies in the acceptable range.
-    auto root = (-half_b - sqrtd) / a; //  root 1
+    // Of q / a and c / q, the roots, the second one takes the place of the
+    // cancelling -half_b + sqrtd. Its sign is then exactly the sign of c, so a ray
+    // leaving from just outside the surface never finds it again at a small t.
+    auto q = -(half_b + std::copysign(sqrt(discriminant), half_b));
+    if (q == 0)
+    {
+        return false; // tangent ray starting on the sphere
+    }
+    root = half_b > 0 ? q / a : c / q;
     if (root < t_min || t_max < root)
     {
-        root = (-half_b + sqrtd) / a; //  root 2
+        root = half_b > 0 ? c / q : q / a;
         if (root < t_min || t_max < root)
         {
             return false;
         }
     }
+    RT_STAT(intersection_hits++);
+    return true;
+}
 
-    rec.t = root;
-    rec.p = r.at(rec.t);
-    vec3 outward_normal = (rec.p - center) / radius;
-    rec.set_face_normal(r, outward_normal);
+/**
+ * @brief Closest hit of r with the sphere of center and radius (negative for
+ * hollow spheres) in [t_min, t_max]; fills rec except for its material.
+ */
+inline bool hit_sphere(const point3 &center, real radius, const ray &r, real t_min, real t_max, hit_record &rec)
+{
+    real root;
+    if (!sphere_root(center, radius, r, t_min, t_max, root))
+    {
+        return false;
+    }
+    set_sphere_hit(center, radius, r, root, rec);
+    return true;
+}
+
+bool sphere::hit(const ray &r, real t_min, real t_max, hit_record &rec) const
+{
+    if (!hit_sphere(center, radius, r, t_min, t_max, rec))
+    {
+        return false;
+    }
     rec.mat_ptr = mat_ptr;
+    return true;
+}
+
+/**
+ * @brief The roots of hit_sphere() for every lane at once; lanes that miss, or
+ * whose roots are out of range, are masked out of the update of hits.t.
+ * hit[k] is set to 1 for the lanes whose closest hit is now this sphere, 0 otherwise.
+ */
+inline void hit_sphere_lanes(real cx, real cy, real cz, real radius, const ray_packet &p, real t_min,
+                             packet_hit &hits, real *hit)
+{
+    RT_STAT(intersection_tests += p.size);
+
+    const auto r2 = radius * radius;
+    // Selects and bitwise operators instead of branches let the loop vectorize;
+    // lanes with a negative discriminant compute NaNs that the mask discards.
+    for (int k = 0; k < p.size; k++)
+    {
+        auto dx = p.direction[0][k], dy = p.direction[1][k], dz = p.direction[2][k];
+        auto ox = p.origin[0][k] - cx, oy = p.origin[1][k] - cy, oz = p.origin[2][k] - cz;
+        auto a = dx * dx + dy * dy + dz * dz;
+        auto half_b = ox * dx + oy * dy + oz * dz;
+        auto c = ox * ox + oy * oy + oz * oz - r2;
+
+        auto discriminant = half_b * half_b - a * c;
+        auto q = -(half_b + std::copysign(sqrt(discriminant), half_b));
+        auto q_over_a = q / a;
+        auto c_over_q = c / q;
+        auto near_root = half_b > 0 ? q_over_a : c_over_q;
+        auto far_root = half_b > 0 ? c_over_q : q_over_a;
+        bool near_ok = (near_root >= t_min) & (near_root <= hits.t[k]);
+        bool far_ok = (far_root >= t_min) & (far_root <= hits.t[k]);
+        bool lane_hit = (discriminant >= 0) & !((c > 0) & (half_b > 0)) & (q != 0) & (near_ok | far_ok);
+
+        auto root = near_ok ? near_root : far_root;
+        hits.t[k] = lane_hit ? root : hits.t[k];
+        hit[k] = lane_hit ? 1 : 0;
+    }
+}
 
+void sphere::hit_packet(const ray_packet &p, real t_min, packet_hit &hits) const
+{
+    real hit[ray_packet::max_size];
+    hit_sphere_lanes(center.x(), center.y(), center.z(), radius, p, t_min, hits, hit);
+
+    for (int k = 0; k < p.size; k++)
+    {
+        if (hit[k] != 0)
+        {
+            RT_STAT(intersection_hits++);
+            hits.object[k] = this;
+        }
+    }
+}
+
+bool sphere::occluded(const ray &r, real t_min, real t_max) const
+{
+    real root;
+    return sphere_root(center, radius, r, t_min, t_max, root);
+}
+
+bool sphere::bounding_box(aabb &output_box) const
+{
+    // radius may be negative for hollow spheres
+    auto r = fabs(radius);
+    output_box = aabb(center - vec3(r, r, r), center + vec3(r, r, r));
     return true;
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,407 @@
+#pragma once
+#ifndef SPHERE_SET_HPP
+#define SPHERE_SET_HPP
+
+#include "../common.hpp"
+#include "arena.hpp"
+#include "bvh.hpp"
+#include "material.hpp"
+#include "sphere.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Spheres in structure-of-arrays layout under their own BVH.
+ *
+ * The set only points at its arrays, so they may as well sit in a read-only
+ * file mapping as in an arena; storage keeps whichever it is alive. Spheres
+ * are in leaf order, the BVH leaves referencing contiguous ranges of them.
+ * A sphere costs 4 reals, a material index and the index it was added with
+ * (which keeps lists such as find_lights() in scene order), against a heap-allocated
+ * polymorphic sphere plus two shared_ptrs to it in a hittable_list and a bvh.
+ */
+class sphere_set : public hittable
+{
+public:
+    struct arrays
+    {
+        const bvh_flat_node *nodes = nullptr;
+        uint32_t node_count = 0;
+        uint32_t count = 0;
+        const real *center[3] = {};
+        const real *radius = nullptr;
+        const uint32_t *material = nullptr; // index into the material table
+        const uint32_t *original = nullptr; // index the sphere was added with, before leaf order
+    };
+
+    // @brief Bytes of one sphere across the arrays: center, radius, material and original index.
+    static constexpr size_t sphere_bytes = 4 * sizeof(real) + 2 * sizeof(uint32_t);
+
+    sphere_set(const arrays &data, std::vector<const material *> materials, std::shared_ptr<const void> storage)
+        : data(data), materials(std::move(materials)), storage(std::move(storage))
+    {
+    }
+
+    bool hit(const ray &r, real t_min, real t_max, hit_record &rec) const override;
+    void hit_packet(const ray_packet &p, real t_min, packet_hit &hits) const override;
+    bool hit_primitive(const ray &r, uint32_t primitive, hit_record &rec) const override;
+    bool occluded(const ray &r, real t_min, real t_max) const override;
+    bool bounding_box(aabb &output_box) const override;
+    shared_ptr<hittable> replicate() const override;
+
+    size_t size() const { return data.count; }
+    size_t node_count() const { return data.node_count; }
+    const arrays &get_arrays() const { return data; }
+    const std::vector<const material *> &get_materials() const { return materials; }
+
+    // @brief Bytes of spheres and nodes, materials excluded.
+    size_t memory_bytes() const
+    {
+        return data.count * sphere_bytes + data.node_count * sizeof(bvh_flat_node);
+    }
+
+private:
+    arrays data;
+    std::vector<const material *> materials;
+    std::shared_ptr<const void> storage;
+
+    point3 center(uint32_t i) const { return {data.center[0][i], data.center[1][i], data.center[2][i]}; }
+
+    uint32_t nearest_in_leaf(uint32_t first, uint32_t count, const ray &r, real t_min, real &closest,
+                             uint32_t nearest) const;
+};
+
+/**
+ * @brief Nearest of the spheres [first, first + count) hit by r in [t_min, closest].
+ * The roots of a chunk of spheres are found in one branch-free loop over the
+ * arrays, the way hit_sphere_lanes handles a packet; closest is then lowered
+ * to the nearest of them.
+ * @return index of that sphere, or nearest if none is closer
+ */
+uint32_t sphere_set::nearest_in_leaf(uint32_t first, uint32_t count, const ray &r, real t_min, real &closest,
+                                     uint32_t nearest) const
+{
+    RT_STAT(intersection_tests += count);
+
+    constexpr uint32_t chunk = 8;
+    const auto ox = r.origin().x(), oy = r.origin().y(), oz = r.origin().z();
+    const auto dx = r.direction().x(), dy = r.direction().y(), dz = r.direction().z();
+    const auto a = r.direction().length_squared();
+    for (uint32_t begin = first; begin < first + count; begin += chunk)
+    {
+        const auto n = std::min(chunk, first + count - begin);
+        const real *cx = data.center[0] + begin, *cy = data.center[1] + begin, *cz = data.center[2] + begin;
+        const real *radius = data.radius + begin;
+        const auto t_max = closest;
+
+        real roots[chunk], hit[chunk];
+        for (uint32_t k = 0; k < n; k++)
+        {
+            auto px = ox - cx[k], py = oy - cy[k], pz = oz - cz[k];
+            auto half_b = px * dx + py * dy + pz * dz;
+            auto c = px * px + py * py + pz * pz - radius[k] * radius[k];
+
+            auto discriminant = half_b * half_b - a * c;
+            auto q = -(half_b + std::copysign(sqrt(discriminant), half_b));
+            auto q_over_a = q / a;
+            auto c_over_q = c / q;
+            auto near_root = half_b > 0 ? q_over_a : c_over_q;
+            auto far_root = half_b > 0 ? c_over_q : q_over_a;
+            bool near_ok = (near_root >= t_min) & (near_root <= t_max);
+            bool far_ok = (far_root >= t_min) & (far_root <= t_max);
+            bool sphere_hit = (discriminant >= 0) & !((c > 0) & (half_b > 0)) & (q != 0) & (near_ok | far_ok);
+
+            roots[k] = near_ok ? near_root : far_root;
+            hit[k] = sphere_hit ? 1 : 0;
+        }
+
+        for (uint32_t k = 0; k < n; k++)
+        {
+            if (hit[k] != 0 && roots[k] <= closest)
+            {
+                RT_STAT(intersection_hits++);
+                closest = roots[k];
+                nearest = begin + k;
+            }
+        }
+    }
+    return nearest;
+}
+
+bool sphere_set::hit(const ray &r, real t_min, real t_max, hit_record &rec) const
+{
+    if (data.node_count == 0)
+    {
+        return false;
+    }
+
+    auto closest_so_far = t_max;
+    uint32_t nearest = data.count;
+    [[maybe_unused]] auto visited = traverse_bvh(data.nodes, r, t_min, closest_so_far,
+                                                 [&](uint32_t first, uint32_t count, real &closest)
+                                                 {
+                                                     nearest =
+                                                         nearest_in_leaf(first, count, r, t_min, closest, nearest);
+                                                 });
+    RT_STAT(node_tests += visited);
+
+    if (nearest == data.count)
+    {
+        return false;
+    }
+    // Only the nearest sphere gets a full hit record.
+    set_sphere_hit(center(nearest), data.radius[nearest], r, closest_so_far, rec);
+    rec.mat_ptr = materials[data.material[nearest]];
+    return true;
+}
+
+void sphere_set::hit_packet(const ray_packet &p, real t_min, packet_hit &hits) const
+{
+    if (data.node_count == 0 || p.size == 0)
+    {
+        return;
+    }
+
+    [[maybe_unused]] auto visited = traverse_bvh_packet(data.nodes, p, t_min, hits,
+                                                        [&](uint32_t first, uint32_t count)
+                                                        {
+                                                            real hit[ray_packet::max_size];
+                                                            for (uint32_t i = first; i < first + count; i++)
+                                                            {
+                                                                hit_sphere_lanes(data.center[0][i], data.center[1][i],
+                                                                                 data.center[2][i], data.radius[i], p,
+                                                                                 t_min, hits, hit);
+                                                                for (int k = 0; k < p.size; k++)
+                                                                {
+                                                                    if (hit[k] != 0)
+                                                                    {
+                                                                        RT_STAT(intersection_hits++);
+                                                                        hits.object[k] = this;
+                                                                        hits.primitive[k] = i;
+                                                                    }
+                                                                }
+                                                            }
+                                                        });
+    RT_STAT(node_tests += visited);
+}
+
+bool sphere_set::hit_primitive(const ray &r, uint32_t primitive, hit_record &rec) const
+{
+    if (primitive >= data.count || !hit_sphere(center(primitive), data.radius[primitive], r, 0, infinity, rec))
+    {
+        return false;
+    }
+    rec.mat_ptr = materials[data.material[primitive]];
+    return true;
+}
+
+bool sphere_set::occluded(const ray &r, real t_min, real t_max) const
+{
+    if (data.node_count == 0)
+    {
+        return false;
+    }
+
+    bool blocked;
+    [[maybe_unused]] auto visited = traverse_bvh_any(data.nodes, r, t_min, t_max, blocked,
+                                                     [&](uint32_t first, uint32_t count)
+                                                     {
+                                                         real root;
+                                                         for (uint32_t i = first; i < first + count; i++)
+                                                         {
+                                                             if (sphere_root(center(i), data.radius[i], r, t_min,
+                                                                             t_max, root))
+                                                             {
+                                                                 return true;
+                                                             }
+                                                         }
+                                                         return false;
+                                                     });
+    RT_STAT(node_tests += visited);
+    return blocked;
+}
+
+bool sphere_set::bounding_box(aabb &output_box) const
+{
+    if (data.node_count == 0)
+    {
+        return false;
+    }
+    output_box = data.nodes[0].box;
+    return true;
+}
+
+/**
+ * @brief Nodes and spheres copied into an arena of their own; the materials,
+ * few and small, stay shared, and so does the storage owning them.
+ */
+shared_ptr<hittable> sphere_set::replicate() const
+{
+    struct copy
+    {
+        arena memory;
+        std::shared_ptr<const void> original;
+    };
+    auto keep_alive = std::make_shared<copy>();
+    keep_alive->original = storage;
+
+    auto clone = [&](const auto *from, size_t count)
+    {
+        using T = std::remove_const_t<std::remove_pointer_t<decltype(from)>>;
+        auto *to = keep_alive->memory.allocate<T>(count);
+        std::copy(from, from + count, to);
+        return to;
+    };
+    arrays copied = data;
+    copied.nodes = clone(data.nodes, data.node_count);
+    for (int a = 0; a < 3; a++)
+    {
+        copied.center[a] = clone(data.center[a], data.count);
+    }
+    copied.radius = clone(data.radius, data.count);
+    copied.material = clone(data.material, data.count);
+    copied.original = clone(data.original, data.count);
+    return make_shared<sphere_set>(copied, materials, std::move(keep_alive));
+}
+
+/**
+ * @brief Collects spheres, then builds a sphere_set over them in arena storage.
+ */
+class sphere_set_builder
+{
+public:
+    // @brief Add a material owned by the set, returns its index.
+    uint32_t add_material(const material &m)
+    {
+        return material_index(owned.add(m));
+    }
+
+    // @brief Index of a material owned by a list passed to keep(), added on first use.
+    uint32_t material_index(const material *m)
+    {
+        auto found = index_of.find(m);
+        if (found != index_of.end())
+        {
+            return found->second;
+        }
+        auto index = static_cast<uint32_t>(table.size());
+        index_of.emplace(m, index);
+        table.push_back(m);
+        return index;
+    }
+
+    // @brief Keep the materials of list alive as long as the set.
+    void keep(const material_list &list) { kept.push_back(list); }
+
+    void reserve(size_t count)
+    {
+        for (auto &axis : centers)
+        {
+            axis.reserve(count);
+        }
+        radii.reserve(count);
+        material_ids.reserve(count);
+    }
+
+    void add(const point3 &c, real r, uint32_t m)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            centers[a].push_back(c[a]);
+        }
+        radii.push_back(r);
+        material_ids.push_back(m);
+    }
+
+    size_t size() const { return radii.size(); }
+
+    /**
+     * @brief Build the BVH, then copy the spheres in leaf order into the arena.
+     * The collected spheres are released on the way, so the builder is left empty.
+     * Leaves are tested a chunk of spheres at a time, which makes a sphere cheap
+     * next to a node visit: the default traversal_cost fills leaves up to
+     * max_leaf_size, which measured 15% faster than single-sphere leaves on
+     * 1k-10k spheres and halves the node count.
+     */
+    shared_ptr<sphere_set> build(size_t max_leaf_size = 4, double traversal_cost = 4)
+    {
+        struct storage
+        {
+            arena memory;
+            std::vector<bvh_flat_node> nodes;
+            material_list owned;
+            std::vector<material_list> kept;
+        };
+        auto keep_alive = std::make_shared<storage>();
+        keep_alive->owned = owned;
+        keep_alive->kept = kept;
+
+        const auto n = radii.size();
+        std::vector<uint32_t> order(n);
+        {
+            std::vector<bvh_build_item> items;
+            items.reserve(n);
+            for (size_t i = 0; i < n; i++)
+            {
+                // Same bounds as sphere::bounding_box, so both get the same tree
+                auto r = fabs(radii[i]);
+                point3 c(centers[0][i], centers[1][i], centers[2][i]);
+                aabb box(c - vec3(r, r, r), c + vec3(r, r, r));
+                items.push_back({box, box.centroid(), static_cast<uint32_t>(i)});
+            }
+            keep_alive->nodes = bvh_builder(max_leaf_size, traversal_cost).build(items);
+            for (size_t k = 0; k < n; k++)
+            {
+                order[k] = items[k].index;
+            }
+        }
+
+        sphere_set::arrays data;
+        data.nodes = keep_alive->nodes.data();
+        data.node_count = static_cast<uint32_t>(keep_alive->nodes.size());
+        data.count = static_cast<uint32_t>(n);
+        for (int a = 0; a < 3; a++)
+        {
+            auto *out = keep_alive->memory.allocate<real>(n);
+            for (size_t k = 0; k < n; k++)
+            {
+                out[k] = centers[a][order[k]];
+            }
+            std::vector<real>().swap(centers[a]);
+            data.center[a] = out;
+        }
+        auto *radius_out = keep_alive->memory.allocate<real>(n);
+        auto *material_out = keep_alive->memory.allocate<uint32_t>(n);
+        auto *original_out = keep_alive->memory.allocate<uint32_t>(n);
+        for (size_t k = 0; k < n; k++)
+        {
+            radius_out[k] = radii[order[k]];
+            material_out[k] = material_ids[order[k]];
+            original_out[k] = order[k];
+        }
+        std::vector<real>().swap(radii);
+        std::vector<uint32_t>().swap(material_ids);
+        data.radius = radius_out;
+        data.material = material_out;
+        data.original = original_out;
+
+        return make_shared<sphere_set>(data, table, std::move(keep_alive));
+    }
+
+private:
+    std::vector<real> centers[3];
+    std::vector<real> radii;
+    std::vector<uint32_t> material_ids;
+
+    std::vector<const material *> table;
+    std::unordered_map<const material *, uint32_t> index_of;
+    material_list owned;
+    std::vector<material_list> kept;
+};
+
+#endif
@@ -0,0 +1,190 @@
+#pragma once
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/**
+ * @brief Counters of one render worker, merged once the frame is done.
+ *
+ * Hot paths update the instance installed for the calling thread with
+ * RT_STAT(...), which compiles to nothing unless RT_STATS is defined and is a
+ * no-op on threads without an installed instance (e.g. during scene setup).
+ * Instances are cache-line aligned so that workers never share a line.
+ */
+struct alignas(64) render_stats
+{
+    static constexpr int material_types = 5;
+
+    struct tile_time
+    {
+        int x0, y0, x1, y1;
+        double seconds;
+    };
+
+    int max_depth = 0;
+
+    uint64_t samples = 0;
+    uint64_t primary_rays = 0;
+    uint64_t rays_traced = 0; // primary and secondary rays handed to the world
+    uint64_t shadow_rays = 0; // occlusion queries of light samples
+    uint64_t node_tests = 0;
+    uint64_t intersection_tests = 0;
+    uint64_t intersection_hits = 0;
+    uint64_t scatter_events[material_types] = {};
+    uint64_t absorbed = 0;
+    uint64_t max_depth_terminations = 0;
+    uint64_t roulette_terminations = 0;
+    std::vector<uint64_t> path_lengths; // paths by number of scatter events
+    std::vector<tile_time> tiles;
+
+    explicit render_stats(int max_depth = 0) : max_depth(max_depth), path_lengths(max_depth + 1, 0) {}
+
+    // @brief Instance counted into by the calling thread, may be null.
+    static render_stats *&current()
+    {
+        thread_local render_stats *stats = nullptr;
+        return stats;
+    }
+
+    void end_path(int bounces)
+    {
+        if (bounces >= 0 && bounces < static_cast<int>(path_lengths.size()))
+        {
+            path_lengths[bounces]++;
+        }
+    }
+
+    void merge(const render_stats &other)
+    {
+        samples += other.samples;
+        primary_rays += other.primary_rays;
+        rays_traced += other.rays_traced;
+        shadow_rays += other.shadow_rays;
+        node_tests += other.node_tests;
+        intersection_tests += other.intersection_tests;
+        intersection_hits += other.intersection_hits;
+        for (int m = 0; m < material_types; m++)
+        {
+            scatter_events[m] += other.scatter_events[m];
+        }
+        absorbed += other.absorbed;
+        max_depth_terminations += other.max_depth_terminations;
+        roulette_terminations += other.roulette_terminations;
+        if (path_lengths.size() < other.path_lengths.size())
+        {
+            path_lengths.resize(other.path_lengths.size(), 0);
+        }
+        for (size_t k = 0; k < other.path_lengths.size(); k++)
+        {
+            path_lengths[k] += other.path_lengths[k];
+        }
+        tiles.insert(tiles.end(), other.tiles.begin(), other.tiles.end());
+    }
+
+    // @brief The counters as a flat array (tile times excluded), to send them between processes.
+    std::vector<uint64_t> pack() const
+    {
+        std::vector<uint64_t> packed = {samples, primary_rays, rays_traced, shadow_rays, node_tests,
+                                        intersection_tests, intersection_hits};
+        packed.insert(packed.end(), scatter_events, scatter_events + material_types);
+        packed.insert(packed.end(), {absorbed, max_depth_terminations, roulette_terminations});
+        packed.insert(packed.end(), path_lengths.begin(), path_lengths.end());
+        return packed;
+    }
+
+    // @brief Add counters produced by pack(); false if packed is malformed.
+    bool merge_packed(const std::vector<uint64_t> &packed)
+    {
+        constexpr size_t fixed = 7 + material_types + 3;
+        if (packed.size() < fixed)
+        {
+            return false;
+        }
+        render_stats other(static_cast<int>(packed.size() - fixed) - 1);
+        auto next = packed.begin();
+        for (auto *counter : {&other.samples, &other.primary_rays, &other.rays_traced, &other.shadow_rays,
+                              &other.node_tests, &other.intersection_tests, &other.intersection_hits})
+        {
+            *counter = *next++;
+        }
+        for (auto &counter : other.scatter_events)
+        {
+            counter = *next++;
+        }
+        for (auto *counter : {&other.absorbed, &other.max_depth_terminations, &other.roulette_terminations})
+        {
+            *counter = *next++;
+        }
+        std::copy(next, packed.end(), other.path_lengths.begin());
+        merge(other);
+        return true;
+    }
+
+    /**
+     * @brief Machine-readable report, seconds is the wall-clock time of the render.
+     */
+    void write_json(std::ostream &out, double seconds) const
+    {
+        static const char *material_names[material_types] = {"lambertian", "metal", "dielectric",
+                                                             "diffuse_light", "custom"};
+
+        out << "{\n"
+            << "  \"seconds\": " << seconds << ",\n"
+            << "  \"samples\": " << samples << ",\n"
+            << "  \"primary_rays\": " << primary_rays << ",\n"
+            << "  \"secondary_rays\": " << rays_traced - primary_rays << ",\n"
+            << "  \"shadow_rays\": " << shadow_rays << ",\n"
+            << "  \"rays_per_second\": " << (seconds > 0 ? rays_traced / seconds : 0) << ",\n"
+            << "  \"bvh_node_tests\": " << node_tests << ",\n"
+            << "  \"intersection_tests\": " << intersection_tests << ",\n"
+            << "  \"intersection_hits\": " << intersection_hits << ",\n"
+            << "  \"scatter_events\": {";
+        for (int m = 0; m < material_types; m++)
+        {
+            out << (m ? ", " : "") << "\"" << material_names[m] << "\": " << scatter_events[m];
+        }
+        out << "},\n"
+            << "  \"absorbed\": " << absorbed << ",\n"
+            << "  \"max_depth_terminations\": " << max_depth_terminations << ",\n"
+            << "  \"roulette_terminations\": " << roulette_terminations << ",\n"
+            << "  \"path_length_histogram\": [";
+        for (size_t k = 0; k < path_lengths.size(); k++)
+        {
+            out << (k ? ", " : "") << path_lengths[k];
+        }
+        out << "],\n"
+            << "  \"tiles\": [";
+        for (size_t k = 0; k < tiles.size(); k++)
+        {
+            const auto &t = tiles[k];
+            out << (k ? ",\n" : "\n") << "    {\"x0\": " << t.x0 << ", \"y0\": " << t.y0
+                << ", \"x1\": " << t.x1 << ", \"y1\": " << t.y1 << ", \"seconds\": " << t.seconds << "}";
+        }
+        out << "\n  ]\n"
+            << "}\n";
+    }
+};
+
+#if defined(RT_STATS)
+constexpr bool render_stats_enabled = true;
+#define RT_STAT(expr)                                     \
+    do                                                    \
+    {                                                     \
+        if (auto *rt_stats_ = render_stats::current())    \
+        {                                                 \
+            rt_stats_->expr;                              \
+        }                                                 \
+    } while (0)
+#else
+constexpr bool render_stats_enabled = false;
+#define RT_STAT(expr) \
+    do                \
+    {                 \
+    } while (0)
+#endif
+
+#endif
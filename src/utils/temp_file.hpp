@@ -0,0 +1,44 @@
+#pragma once
+#ifndef TEMP_FILE_HPP
+#define TEMP_FILE_HPP
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief Create a file of a unique name next to path, to be written and then
+ * renamed over path. Processes writing the same path at once each get their
+ * own file, so none of them renames a mix of their writes into place.
+ * @param fd receives the open descriptor; when null the file is closed
+ * @return the file's name, empty if it could not be created
+ */
+inline std::string create_temporary(const std::string &path, int *fd = nullptr)
+{
+    std::string pattern = path + ".tmp-XXXXXX";
+    std::vector<char> name(pattern.begin(), pattern.end());
+    name.push_back('\0');
+    int created = ::mkstemp(name.data());
+    if (created < 0)
+    {
+        return {};
+    }
+    // mkstemp creates the file private to its owner
+    ::fchmod(created, 0644);
+    ::fcntl(created, F_SETFD, FD_CLOEXEC);
+    if (fd != nullptr)
+    {
+        *fd = created;
+    }
+    else
+    {
+        ::close(created);
+    }
+    return name.data();
+}
+
+#endif
@@ -0,0 +1,212 @@
+#pragma once
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include "affinity.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Fixed set of worker threads running index ranges with work stealing.
+ *
+ * parallel_for deals the indices out in contiguous blocks, one per worker, so
+ * neighbouring tasks stay on the same thread. A worker pops from the front of
+ * its own queue and, once empty, steals from the back of the others.
+ * In order, every worker takes the next index of a shared counter instead,
+ * so the indices in flight at any time are never more than the workers apart.
+ * The calling thread takes part as worker 0.
+ *
+ * Given cpus, one per worker, each worker is pinned to its CPU for life, the
+ * calling thread included, so that its caches and the memory it first
+ * touched stay where it runs.
+ */
+class thread_pool
+{
+public:
+    using task = std::function<void(size_t index, unsigned worker)>;
+
+    explicit thread_pool(unsigned num_threads = std::thread::hardware_concurrency(),
+                         const std::vector<int> &cpus = {})
+    {
+        num_threads = std::max(1u, num_threads);
+        for (unsigned i = 0; i < num_threads; i++)
+        {
+            queues.push_back(std::make_unique<task_queue>());
+        }
+        if (!cpus.empty())
+        {
+            pin_current_thread(cpus[0]);
+        }
+        for (unsigned i = 1; i < num_threads; i++)
+        {
+            int cpu = i < cpus.size() ? cpus[i] : -1;
+            workers.emplace_back([this, i, cpu]()
+                                 {
+                                     if (cpu >= 0)
+                                     {
+                                         pin_current_thread(cpu);
+                                     }
+                                     worker_loop(i);
+                                 });
+        }
+    }
+
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    thread_pool(const thread_pool &) = delete;
+    thread_pool &operator=(const thread_pool &) = delete;
+
+    unsigned size() const { return static_cast<unsigned>(queues.size()); }
+
+    /**
+     * @brief Run fn(index, worker) for every index in [0, count), returns when all are done.
+     * @param in_order start the indices in increasing order rather than in a block per worker
+     */
+    void parallel_for(size_t count, const task &fn, bool in_order = false)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+
+        auto n = size();
+        ordered_count = in_order ? count : 0;
+        next_ordered.store(0, std::memory_order_relaxed);
+        for (unsigned w = 0; w < n && !in_order; w++)
+        {
+            auto begin = count * w / n;
+            auto end = count * (w + 1) / n;
+            std::lock_guard<std::mutex> lock(queues[w]->mutex);
+            for (auto i = begin; i < end; i++)
+            {
+                queues[w]->tasks.push_back(i);
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &fn;
+            busy = n - 1;
+            generation++;
+        }
+        wake.notify_all();
+
+        run_tasks(0, fn);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]()
+                  { return busy == 0; });
+        job = nullptr;
+    }
+
+private:
+    struct alignas(64) task_queue
+    {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+
+    std::vector<std::unique_ptr<task_queue>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const task *job = nullptr;
+    size_t ordered_count = 0; // indices of an in-order parallel_for, 0 otherwise
+    std::atomic<size_t> next_ordered{0};
+    unsigned busy = 0;
+    unsigned long generation = 0;
+    bool stopping = false;
+
+    void worker_loop(unsigned id)
+    {
+        unsigned long seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            wake.wait(lock, [&]()
+                      { return stopping || generation != seen; });
+            if (stopping)
+            {
+                return;
+            }
+            seen = generation;
+            const task *fn = job;
+            lock.unlock();
+
+            run_tasks(id, *fn);
+
+            lock.lock();
+            if (--busy == 0)
+            {
+                done.notify_all();
+            }
+        }
+    }
+
+    void run_tasks(unsigned id, const task &fn)
+    {
+        size_t index;
+        while (pop_task(id, index))
+        {
+            fn(index, id);
+        }
+    }
+
+    bool pop_task(unsigned id, size_t &index)
+    {
+        if (ordered_count > 0)
+        {
+            index = next_ordered.fetch_add(1, std::memory_order_relaxed);
+            return index < ordered_count;
+        }
+
+        {
+            auto &own = *queues[id];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty())
+            {
+                index = own.tasks.front();
+                own.tasks.pop_front();
+                return true;
+            }
+        }
+
+        // Steal from the back, the part the owner would reach last.
+        auto n = size();
+        for (unsigned k = 1; k < n; k++)
+        {
+            auto &victim = *queues[(id + k) % n];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty())
+            {
+                index = victim.tasks.back();
+                victim.tasks.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+#endif
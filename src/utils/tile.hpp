@@ -0,0 +1,79 @@
+#pragma once
+#ifndef TILE_HPP
+#define TILE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Rectangle of pixels [x0, x1) x [y0, y1), the unit of work of the render loop.
+ */
+struct tile
+{
+    int x0, y0;
+    int x1, y1;
+
+    int width() const { return x1 - x0; }
+    int height() const { return y1 - y0; }
+    int pixel_count() const { return width() * height(); }
+};
+
+// @brief Interleave the bits of x and y, the Z-order curve index of a tile.
+inline uint64_t morton_code(uint32_t x, uint32_t y)
+{
+    auto spread = [](uint64_t v)
+    {
+        v &= 0xffffffff;
+        v = (v | (v << 16)) & 0x0000ffff0000ffff;
+        v = (v | (v << 8)) & 0x00ff00ff00ff00ff;
+        v = (v | (v << 4)) & 0x0f0f0f0f0f0f0f0f;
+        v = (v | (v << 2)) & 0x3333333333333333;
+        v = (v | (v << 1)) & 0x5555555555555555;
+        return v;
+    };
+    return spread(x) | (spread(y) << 1);
+}
+
+enum class tile_order
+{
+    morton,  // consecutive tiles spatially close, for cache reuse
+    scanline // row of tiles after row of tiles, so that rows complete one by one
+};
+
+/**
+ * @brief Cover a width x height image with tiles of at most tile_size x tile_size pixels,
+ * ordered along the Morton curve so that consecutive tiles are spatially close,
+ * or in scanline order.
+ */
+inline std::vector<tile> make_tiles(int width, int height, int tile_size, tile_order order = tile_order::morton)
+{
+    tile_size = std::max(1, tile_size);
+    auto tiles_x = (width + tile_size - 1) / tile_size;
+    auto tiles_y = (height + tile_size - 1) / tile_size;
+
+    std::vector<std::pair<uint64_t, tile>> ordered;
+    ordered.reserve(static_cast<size_t>(tiles_x) * tiles_y);
+    for (int ty = 0; ty < tiles_y; ty++)
+    {
+        for (int tx = 0; tx < tiles_x; tx++)
+        {
+            tile t{tx * tile_size, ty * tile_size,
+                   std::min(width, (tx + 1) * tile_size), std::min(height, (ty + 1) * tile_size)};
+            ordered.emplace_back(order == tile_order::morton ? morton_code(tx, ty) : ordered.size(), t);
+        }
+    }
+    std::sort(ordered.begin(), ordered.end(),
+              [](const std::pair<uint64_t, tile> &a, const std::pair<uint64_t, tile> &b)
+              { return a.first < b.first; });
+
+    std::vector<tile> tiles;
+    tiles.reserve(ordered.size());
+    for (const auto &entry : ordered)
+    {
+        tiles.push_back(entry.second);
+    }
+    return tiles;
+}
+
+#endif
@@ -0,0 +1,241 @@
+#pragma once
+#ifndef TILE_WRITER_HPP
+#define TILE_WRITER_HPP
+
+#include "color.hpp"
+#include "framebuffer.hpp"
+#include "image_io.hpp"
+#include "temp_file.hpp"
+#include "tile.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+ * @brief Streams finished tiles into an image file from its own thread.
+ *
+ * The file, PFM if its name ends in .pfm and binary PPM otherwise, is
+ * allocated at its full size up front and mapped, and each tile is encoded
+ * straight into its rows of the mapping; the kernel writes the pages back
+ * while the render goes on. At most max_in_flight tiles wait to be encoded:
+ * submit() blocks beyond that, so the memory held is bounded by the tiles in
+ * flight whatever the image size. Once all tiles of a row of tiles are
+ * written, its pages are handed to writeback and dropped from the mapping,
+ * so only the rows of tiles not yet complete stay resident. With tiles
+ * started in scanline order, as an in-order thread_pool::parallel_for does,
+ * those are the rows spanned by the tiles being rendered or queued: one or
+ * two once a row holds more tiles than that. Dealt out a block per thread,
+ * tiles would keep a row per thread resident. Like write_image(), the file is
+ * written next to path and renamed over it by finish(), and removed if never
+ * finished.
+ */
+class tile_writer
+{
+public:
+    tile_writer(std::string path, int width, int height, size_t max_in_flight)
+        : path(std::move(path)), width(width), height(height), pfm(is_pfm_path(this->path)),
+          max_in_flight(std::max<size_t>(1, max_in_flight))
+    {
+        const auto header = image_header(pfm, width, height);
+        header_bytes = header.size();
+        length = header_bytes + static_cast<size_t>(width) * height * 3 * (pfm ? sizeof(float) : 1);
+
+        temporary = create_temporary(this->path, &fd);
+        if (temporary.empty())
+        {
+            return;
+        }
+        // Reserving the blocks now fails early on a full disk, where a store
+        // into a page that cannot be backed would raise SIGBUS mid-render.
+        if (::posix_fallocate(fd, 0, static_cast<off_t>(length)) == 0)
+        {
+            auto *mapping = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (mapping != MAP_FAILED)
+            {
+                bytes = static_cast<unsigned char *>(mapping);
+                std::memcpy(bytes, header.data(), header_bytes);
+            }
+        }
+        if (bytes == nullptr)
+        {
+            ::close(fd);
+            fd = -1;
+            std::remove(temporary.c_str());
+            return;
+        }
+        thread = std::thread([this]()
+                             { run(); });
+    }
+
+    ~tile_writer()
+    {
+        stop();
+        if (bytes != nullptr)
+        {
+            ::munmap(bytes, length);
+            ::close(fd);
+            std::remove(temporary.c_str());
+        }
+    }
+
+    tile_writer(const tile_writer &) = delete;
+    tile_writer &operator=(const tile_writer &) = delete;
+
+    // @brief Whether the file could be created and mapped.
+    bool is_open() const { return bytes != nullptr; }
+
+    /**
+     * @brief Queue the resolved pixels of t for writing, rows top to bottom
+     * like the image's. Blocks while max_in_flight tiles are queued.
+     */
+    void submit(const tile &t, framebuffer pixels)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        slot_free.wait(lock, [this]()
+                       { return queue.size() < max_in_flight; });
+        queue.emplace_back(t, std::move(pixels));
+        tile_ready.notify_one();
+    }
+
+    /**
+     * @brief Write the queued tiles, unmap the file and rename it over path.
+     * @return false if the file could not be finished
+     */
+    bool finish()
+    {
+        if (bytes == nullptr)
+        {
+            return false;
+        }
+        stop();
+        bool unmapped = ::munmap(bytes, length) == 0;
+        bool closed = ::close(fd) == 0;
+        bytes = nullptr;
+        fd = -1;
+        if (!unmapped || !closed || std::rename(temporary.c_str(), path.c_str()) != 0)
+        {
+            std::remove(temporary.c_str());
+            return false;
+        }
+        return true;
+    }
+
+private:
+    std::string path;
+    std::string temporary; // written, then renamed to path
+    int width, height;
+    bool pfm;
+    size_t max_in_flight;
+    size_t header_bytes = 0;
+    size_t length = 0;
+    int fd = -1;
+    unsigned char *bytes = nullptr;
+    std::unordered_map<int, size_t> band_pixels; // pixels written per row of tiles, by its y0
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable tile_ready, slot_free;
+    std::deque<std::pair<tile, framebuffer>> queue;
+    bool stopping = false;
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        tile_ready.notify_one();
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+    }
+
+    void run()
+    {
+        std::vector<float> row;
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;)
+        {
+            tile_ready.wait(lock, [this]()
+                            { return !queue.empty() || stopping; });
+            if (queue.empty())
+            {
+                return;
+            }
+            auto entry = std::move(queue.front());
+            queue.pop_front();
+            slot_free.notify_one();
+
+            lock.unlock();
+            write_tile(entry.first, entry.second, row);
+            lock.lock();
+        }
+    }
+
+    // Tile y rows are counted from the bottom of the image, framebuffer rows
+    // from the top; PPM stores rows top to bottom and PFM bottom to top.
+    void write_tile(const tile &t, const framebuffer &pixels, std::vector<float> &row)
+    {
+        const auto n = static_cast<size_t>(t.width());
+        for (int r = 0; r < pixels.height(); r++)
+        {
+            const auto top_row = static_cast<size_t>(height - t.y1 + r);
+            if (pfm)
+            {
+                // The header leaves the pixels unaligned for floats
+                row.resize(n * 3);
+                resolve_pixels(pixels.at(0, r), n, row.data());
+                auto offset = ((height - 1 - top_row) * width + t.x0) * 3 * sizeof(float);
+                std::memcpy(bytes + header_bytes + offset, row.data(), n * 3 * sizeof(float));
+            }
+            else
+            {
+                quantize_pixels(pixels.at(0, r), n, bytes + header_bytes + (top_row * width + t.x0) * 3);
+            }
+        }
+
+        auto &written = band_pixels[t.y0];
+        written += static_cast<size_t>(t.pixel_count());
+        if (written == static_cast<size_t>(width) * t.height())
+        {
+            band_pixels.erase(t.y0);
+            release_rows(pfm ? t.y0 : height - t.y1, t.height());
+        }
+    }
+
+    // @brief Start writeback of count rows of the file from first, and drop their whole pages.
+    void release_rows(int first, int count) const
+    {
+        const auto row_bytes = static_cast<size_t>(width) * 3 * (pfm ? sizeof(float) : 1);
+        const auto page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+        auto begin = header_bytes + first * row_bytes;
+        auto end = begin + count * row_bytes;
+        begin = (begin + page - 1) / page * page; // the edge pages are shared with the next rows
+        end = end / page * page;
+        if (end <= begin)
+        {
+            return;
+        }
+#if defined(__linux__)
+        ::sync_file_range(fd, static_cast<off_t>(begin), static_cast<off_t>(end - begin), SYNC_FILE_RANGE_WRITE);
+#endif
+        // Dirty pages of a shared file mapping stay in the page cache until written
+        ::madvise(bytes + begin, end - begin, MADV_DONTNEED);
+    }
+};
+
+#endif
@@ -5,6 +5,8 @@
 #include <cmath>
 #include <iostream>
 
+#include "simd.hpp"
+
 using std::sqrt;
 
 class vec3
@@ -12,21 +14,32 @@ class vec3
 public:
     vec3() : e{0, 0, 0} {};
 
-    vec3(double e0, double e1, double e2) : e{e0, e1, e2}
+    vec3(real e0, real e1, real e2) : e{e0, e1, e2}
+    {
+    }
+
+    explicit vec3(simd::packed3 v)
     {
+        simd::store(e, v);
     }
 
-    double x() const
+    // @brief Components as a kernel operand.
+    simd::packed3 lanes() const
+    {
+        return simd::load(e);
+    }
+
+    real x() const
     {
         return e[0];
     }
 
-    double y() const
+    real y() const
     {
         return e[1];
     }
 
-    double z() const
+    real z() const
     {
         return e[2];
     }
@@ -36,27 +49,26 @@ public:
         return {random_double(), random_double(), random_double()};
     }
 
-    inline static vec3 random(double min, double max)
+    inline static vec3 random(real min, real max)
     {
         return {random_double(min, max), random_double(min, max), random_double(min, max)};
     }
 
+    // Direct mappings of 2 or 3 random numbers rather than rejection sampling,
+    // so each call draws a fixed number of sample dimensions.
+
     inline static vec3 random_in_unit_sphere()
     {
-        while (true)
-        {
-            auto p = vec3::random(-1, 1);
-            if (p.length_squared() >= 1)
-            {
-                continue;
-            }
-            return p;
-        }
+        auto direction = random_unit_vector();
+        return direction *= std::cbrt(random_double());
     }
 
     inline static vec3 random_unit_vector()
     {
-        return random_in_unit_sphere().unit_vector();
+        auto z = 1 - 2 * random_double();
+        auto phi = 2 * pi * random_double();
+        auto r = std::sqrt(std::fmax(static_cast<real>(0), 1 - z * z));
+        return {r * std::cos(phi), r * std::sin(phi), z};
     }
 
     inline static vec3 random_in_hemisphere(const vec3 &normal)
@@ -69,17 +81,22 @@ public:
         return -in_unit_sphere;
     }
 
+    // @brief Concentric (Shirley-Chiu) mapping of the square onto the disk.
     inline static vec3 random_in_unit_disk()
     {
-        while (true)
+        auto a = 2 * random_double() - 1;
+        auto b = 2 * random_double() - 1;
+        if (a == 0 && b == 0)
+        {
+            return {0, 0, 0};
+        }
+        if (fabs(a) > fabs(b))
         {
-            auto p = vec3(random_double(-1, 1), random_double(-1, 1), 0);
-            if (p.length_squared() >= 1)
-            {
-                continue;
-            }
-            return p;
+            auto theta = pi / 4 * (b / a);
+            return {a * std::cos(theta), a * std::sin(theta), 0};
         }
+        auto theta = pi / 2 - pi / 4 * (a / b);
+        return {b * std::cos(theta), b * std::sin(theta), 0};
     }
 
     // Return true if the vector is close to zero in all dimensions.
@@ -91,64 +108,57 @@ public:
 
     vec3 operator-() const
     {
-        return {-e[0], -e[1], -e[2]};
+        return vec3(-lanes());
     }
 
-    double operator[](int i) const
+    real operator[](int i) const
     {
         return e[i];
     }
 
-    double &operator[](int i)
+    real &operator[](int i)
     {
         return e[i];
     }
 
-    vec3 operator+=(const vec3 &v)
+    vec3 &operator+=(const vec3 &v)
     {
-        for (int i = 0; i < 3; ++i)
-        {
-            e[i] += v[i];
-        }
+        simd::store(e, lanes() + v.lanes());
         return *this;
     }
 
-    vec3 &operator*=(const double t)
+    vec3 &operator*=(const real t)
     {
-        for (double &i : e)
-        {
-            i *= t;
-        }
+        simd::store(e, lanes() * simd::broadcast(t));
         return *this;
     }
 
-    vec3 &operator/=(const double t)
+    vec3 &operator/=(const real t)
     {
         return *this *= 1 / t;
     }
 
-    double length() const
+    real length() const
     {
         return sqrt(length_squared());
     }
 
-    double length_squared() const
+    real length_squared() const
     {
-        return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
+        auto v = lanes();
+        return simd::hsum3(v * v);
     }
 
-    inline double dot(const vec3 &v) const
+    inline real dot(const vec3 &v) const
     {
-        auto &u = *this;
-        return (u[0] * v[0] + u[1] * v[1] + u[2] * v[2]);
+        return simd::hsum3(lanes() * v.lanes());
     }
 
     inline vec3 cross(const vec3 &v) const
     {
-        auto &u = *this;
-        return {u[1] * v[2] - u[2] * v[1],
-                    u[2] * v[0] - u[0] * v[2],
-                    u[0] * v[1] - u[1] * v[0]};
+        auto a = lanes();
+        auto b = v.lanes();
+        return vec3(simd::yzx(a * simd::yzx(b) - simd::yzx(a) * b));
     }
 
     /**
@@ -156,10 +166,11 @@ public:
      *
      * @return vec3
      */
-    inline vec3 unit_vector();
+    inline vec3 unit_vector() const;
 
 private:
-    double e[3];
+    // With 4 lanes w is kept at zero so that whole-register operations stay exact.
+    alignas(simd::lanes == 4 ? 4 * sizeof(real) : alignof(real)) real e[simd::lanes];
 };
 
 // Type aliases for vec3
@@ -176,38 +187,38 @@ inline std::ostream &operator<<(std::ostream &out, const vec3 &v)
 
 inline vec3 operator+(const vec3 &u, const vec3 &v)
 {
-    return {u[0] + v[0], u[1] + v[1], u[2] + v[2]};
+    return vec3(u.lanes() + v.lanes());
 }
 
 inline vec3 operator-(const vec3 &u, const vec3 &v)
 {
-    return {u[0] - v[0], u[1] - v[1], u[2] - v[2]};
+    return vec3(u.lanes() - v.lanes());
 }
 
 inline vec3 operator*(const vec3 &u, const vec3 &v)
 {
-    return {u[0] * v[0], u[1] * v[1], u[2] * v[2]};
+    return vec3(u.lanes() * v.lanes());
 }
 
-inline vec3 operator*(double t, const vec3 &v)
+inline vec3 operator*(real t, const vec3 &v)
 {
-    return {t * v[0], t * v[1], t * v[2]};
+    return vec3(simd::broadcast(t) * v.lanes());
 }
 
-inline vec3 operator*(const vec3 &v, double t)
+inline vec3 operator*(const vec3 &v, real t)
 {
     return t * v;
 }
 
-inline vec3 operator/(vec3 v, double t)
+inline vec3 operator/(vec3 v, real t)
 {
     return (1 / t) * v;
 }
 
-vec3 vec3::unit_vector()
+vec3 vec3::unit_vector() const
 {
-    vec3 &v = *this;
-    return v / v.length();
+    auto v = lanes();
+    return vec3(simd::broadcast(1 / sqrt(simd::hsum3(v * v))) * v);
 }
 
 vec3 reflect(const vec3 &v, const vec3 &n)
@@ -215,7 +226,7 @@ vec3 reflect(const vec3 &v, const vec3 &n)
     return v + 2 * (-v.dot(n)) * n;
 }
 
-vec3 refract(const vec3 &uv, const vec3 &n, double etai_over_etat)
+vec3 refract(const vec3 &uv, const vec3 &n, real etai_over_etat)
 {
     auto cos_theta = fmin((-uv).dot(n), 1.0);
     vec3 r_out_perp = etai_over_etat * (uv + cos_theta * n);